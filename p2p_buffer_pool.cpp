@@ -0,0 +1,128 @@
+#include "p2p_buffer_pool.h"
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+namespace p2p
+{
+
+namespace
+{
+
+constexpr size_t MIN_BLOCK_SIZE = 512;
+constexpr size_t SIZE_CLASSES_COUNT = 12;
+constexpr size_t MAX_CACHED_BYTES = 1024 * 1024;
+
+class buffer_pool
+{
+public:
+    char *allocate(size_t &size)
+    {
+        size_t index = size_class(size);
+        if (index >= SIZE_CLASSES_COUNT)
+        {
+            return static_cast<char*>(::operator new(size));
+        }
+
+        size = class_size(index);
+        size_class_blocks &c = classes[index];
+        {
+            lock_guard<mutex> lck(c.blocks_mutex);
+            if (!c.blocks.empty())
+            {
+                char *p = c.blocks.back();
+                c.blocks.pop_back();
+                return p;
+            }
+        }
+        return static_cast<char*>(::operator new(size));
+    }
+
+    void deallocate(char *p, size_t size) noexcept
+    {
+        size_t index = size_class(size);
+        if (index < SIZE_CLASSES_COUNT)
+        {
+            size_class_blocks &c = classes[index];
+            lock_guard<mutex> lck(c.blocks_mutex);
+            if (c.blocks.size() < max<size_t>(1, MAX_CACHED_BYTES / size))
+            {
+                try
+                {
+                    c.blocks.push_back(p);
+                    return;
+                }
+                catch (bad_alloc&)
+                {
+                }
+            }
+        }
+        ::operator delete(p);
+    }
+
+private:
+    struct size_class_blocks
+    {
+        mutex blocks_mutex;
+        vector<char*> blocks;
+    };
+    size_class_blocks classes[SIZE_CLASSES_COUNT];
+
+    static size_t class_size(size_t index)
+    {
+        return MIN_BLOCK_SIZE << index;
+    }
+
+    static size_t size_class(size_t size)
+    {
+        size_t index = 0;
+        while (index < SIZE_CLASSES_COUNT && class_size(index) < size)
+        {
+            ++index;
+        }
+        return index;
+    }
+};
+
+buffer_pool &get_pool()
+{
+    static buffer_pool *pool = new buffer_pool{};
+    return *pool;
+}
+
+}
+
+void pooled_buffer::reserve(size_t size, size_t keep)
+{
+    if (size <= capacity_value)
+    {
+        return;
+    }
+
+    char *p = get_pool().allocate(size);
+    if (data_ptr)
+    {
+        memcpy(p, data_ptr, min(keep, capacity_value));
+        get_pool().deallocate(data_ptr, capacity_value);
+    }
+    data_ptr = p;
+    capacity_value = size;
+}
+
+void pooled_buffer::release() noexcept
+{
+    if (data_ptr)
+    {
+        get_pool().deallocate(data_ptr, capacity_value);
+        data_ptr = nullptr;
+        capacity_value = 0;
+    }
+}
+
+}
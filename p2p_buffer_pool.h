@@ -0,0 +1,32 @@
+#ifndef P2P_BUFFER_POOL_H
+#define P2P_BUFFER_POOL_H
+
+#include <cstddef>
+
+namespace p2p
+{
+
+class pooled_buffer
+{
+public:
+    pooled_buffer() = default;
+    ~pooled_buffer() { release(); }
+
+    pooled_buffer(const pooled_buffer&) = delete;
+    pooled_buffer &operator=(const pooled_buffer&) = delete;
+
+    char *data() { return data_ptr; }
+    const char *data() const { return data_ptr; }
+    size_t capacity() const { return capacity_value; }
+
+    void reserve(size_t size, size_t keep = 0);
+    void release() noexcept;
+
+private:
+    char *data_ptr = nullptr;
+    size_t capacity_value = 0;
+};
+
+}
+
+#endif // P2P_BUFFER_POOL_H
@@ -5,6 +5,9 @@
 #include <map>
 #include <unordered_map>
 #include <memory>
+#include <deque>
+#include <mutex>
+#include <utility>
 #include <stdexcept>
 
 #include "p2p_common.h"
@@ -19,15 +22,199 @@ constexpr int MAJOR = 0;
 constexpr int MINOR = 0;
 constexpr int PATCH = 0;
 
-client::client() : con{connection::create()}
+constexpr size_t EVENT_QUEUE_CAPACITY = 4096;
+constexpr size_t CONTACTS_BATCHES_IN_FLIGHT = 4;
+
+namespace
+{
+
+const unordered_map<string, client::register_result> register_answers =
+{
+    {"OK", client::register_result::OK},
+    {"NEED_CODE", client::register_result::NEED_CODE},
+    {"INVALID_CODE", client::register_result::INVALID_CODE},
+    {"ALREADY_EXISTS", client::register_result::ALREADY_EXISTS}
+};
+
+const unordered_map<string, client::unregister_result> unregister_answers =
+{
+    {"OK", client::unregister_result::OK},
+    {"INVALID_ACTION", client::unregister_result::INVALID_ACTION},
+    {"INVALID_PHONE", client::unregister_result::INVALID_PHONE},
+    {"INVALID_PASSWORD", client::unregister_result::INVALID_PASSWORD}
+};
+
+const unordered_map<string, client::autorize_result> autorize_answers =
+{
+    {"OK", client::autorize_result::OK},
+    {"INVALID_ACTION", client::autorize_result::INVALID_ACTION},
+    {"INVALID_PHONE", client::autorize_result::INVALID_PHONE},
+    {"INVALID_PASSWORD", client::autorize_result::INVALID_PASSWORD}
+};
+
+class contacts_lookup : public enable_shared_from_this<contacts_lookup>
+{
+public:
+    contacts_lookup(connection::ptr con, client::phones_list phones,
+                    client::contacts_chunk_handler on_chunk,
+                    client::contacts_completion_handler on_complete) :
+        con{con}, phones{move(phones)}, on_chunk{move(on_chunk)},
+        on_complete{move(on_complete)}
+    {
+    }
+
+    void start()
+    {
+        if (phones.empty())
+        {
+            on_complete(true);
+            return;
+        }
+        send_batches();
+    }
+
+private:
+    using contacts_dictionary = client::contacts_dictionary;
+
+    connection::ptr con;
+    const client::phones_list phones;
+    client::contacts_chunk_handler on_chunk;
+    client::contacts_completion_handler on_complete;
+
+    mutex lookup_mutex;
+    size_t next = 0;
+    size_t in_flight = 0;
+    bool failed = false;
+    bool completed = false;
+
+    void send_batches()
+    {
+        vector<unique_ptr<get_contacts_request>> requests;
+        vector<shared_ptr<contacts_dictionary>> results;
+        {
+            lock_guard<mutex> lck(lookup_mutex);
+            while (!failed && next < phones.size() &&
+                   in_flight < CONTACTS_BATCHES_IN_FLIGHT)
+            {
+                size_t end = contacts_batch_end(phones, next);
+                results.push_back(make_shared<contacts_dictionary>());
+                requests.push_back(make_unique<get_contacts_request>(
+                    client::phones_list(phones.begin() + next,
+                                        phones.begin() + end),
+                    results.back()));
+                next = end;
+                ++in_flight;
+            }
+        }
+
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            con->send_request(move(requests[i]),
+                [self = shared_from_this(), result = results[i]]
+                (connection::answer_state state)
+                { self->complete_batch(*result, state); });
+        }
+    }
+
+    void complete_batch(const contacts_dictionary &result,
+                        connection::answer_state state)
+    {
+        bool ready = state == connection::answer_state::READY;
+        if (ready)
+        {
+            on_chunk(result);
+        }
+
+        bool done;
+        {
+            lock_guard<mutex> lck(lookup_mutex);
+            --in_flight;
+            failed = failed || !ready;
+            done = in_flight == 0 && (failed || next == phones.size()) &&
+                   !completed;
+            completed = completed || done;
+        }
+
+        if (done)
+        {
+            on_complete(!failed);
+        }
+        else
+        {
+            send_batches();
+        }
+    }
+};
+
+}
+
+client::client(service_pool::ptr pool) :
+    pool{pool ? pool : service_pool::create(1)},
+    con{connection::create(this->pool->get_service(),
+                           this->pool->is_caller_driven())},
+    peers{peer_manager::create(this->pool->get_service(), con)},
+    events{make_shared<event_queue>(EVENT_QUEUE_CAPACITY)},
+    dispatcher{make_shared<event_dispatcher>()}
 {
     client_version = p2p::to_string(version_type{MAJOR, MINOR, PATCH});
+    last_message_id = static_cast<message_id_type>(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now().time_since_epoch())
+                .count());
+
+    auto deliver = [events = events, dispatcher = dispatcher](event::ptr e)
+        {
+            if (e->code() != events_code::DISCONNECTED)
+            {
+                if (!dispatcher->dispatch(e))
+                {
+                    events->push(move(e));
+                }
+            }
+            else if (dispatcher->dispatch(e) || !events->try_push(move(e)))
+            {
+                events->notify();
+            }
+        };
+    peers->set_event_handler(deliver);
+    con->set_event_handler(
+        [deliver, weak = weak_ptr<peer_manager>{peers}](event::ptr e)
+        {
+            auto peers = weak.lock();
+            if (!peers || !peers->observe(e))
+            {
+                deliver(move(e));
+            }
+        });
+    con->set_endpoint_handler(
+        [weak = weak_ptr<peer_manager>{peers}](friend_id_type friend_id,
+                                                const peer_endpoint &endpoint)
+        {
+            if (auto peers = weak.lock())
+            {
+                peers->endpoint_received(friend_id, endpoint);
+            }
+        });
 }
 
-client::ptr client::create()
+client::~client()
 {
-    auto cl = new client{};
-    return ptr{cl};
+    events->close();
+    peers->close_all();
+    con->close_connection();
+}
+
+client::ptr client::create(service_pool::ptr pool)
+{
+    auto cl = ptr{new client{pool}};
+    cl->con->set_reconnect_handler([weak = weak_ptr<client>{cl}]
+    {
+        if (auto self = weak.lock())
+        {
+            self->resume_session();
+        }
+    });
+    return cl;
 }
 
 string client::to_string(client::connection_result v)
@@ -63,6 +250,146 @@ bool client::connect_to_server(string address, uint16_t port,
         return true;
     }
 
+    auto version = make_shared<version_type>();
+    return open_connection(move(address), port,
+                           make_unique<get_version_request>(version), version,
+                           result);
+}
+
+void client::async_connect_to_server(string address, uint16_t port,
+                                     connection_handler handler)
+{
+    if (con->is_connected())
+    {
+        handler(connection_result::OK);
+        return;
+    }
+
+    auto version = make_shared<version_type>();
+    async_open_connection(move(address), port,
+                          [version]
+                          { return make_unique<get_version_request>(version); },
+                          version, move(handler));
+}
+
+future<client::connection_result> client::async_connect_to_server(
+        string address, uint16_t port)
+{
+    return make_future<connection_result>(
+        [this, &address, port](connection_handler handler)
+        { async_connect_to_server(move(address), port, move(handler)); });
+}
+
+bool client::connect_to_server(string address, uint16_t port,
+                               string phone, string password,
+                               connection_result &result,
+                               autorize_result &autorize)
+{
+    if (con->is_connected())
+    {
+        result = connection_result::OK;
+        autorize = autorize_on_server(move(phone), move(password));
+        return true;
+    }
+
+    auto version = make_shared<version_type>();
+    auto answer = make_shared<string>();
+    auto token = make_shared<string>();
+    auto r = make_unique<get_version_request>(version, phone, password, answer,
+                                              token);
+    if (!open_connection(move(address), port, move(r), version, result))
+    {
+        autorize = result == connection_result::FAILED ?
+                    autorize_result::FAILED : autorize_result::DISCONNECTED;
+        return false;
+    }
+
+    if (answer->empty())
+    {
+        autorize = autorize_on_server(move(phone), move(password));
+    }
+    else
+    {
+        autorize = combined_autorize_result(move(phone), move(password),
+                                            *answer, move(*token));
+    }
+    return true;
+}
+
+void client::async_connect_to_server(string address, uint16_t port,
+                                     string phone, string password,
+                                     connection_autorize_handler handler)
+{
+    if (con->is_connected())
+    {
+        async_autorize_on_server(move(phone), move(password),
+            [handler](autorize_result autorize)
+            { handler(connection_result::OK, autorize); });
+        return;
+    }
+
+    auto version = make_shared<version_type>();
+    auto answer = make_shared<string>();
+    auto token = make_shared<string>();
+    async_open_connection(move(address), port,
+        [version, phone, password, answer, token]
+        {
+            return make_unique<get_version_request>(version, phone, password,
+                                                    answer, token);
+        },
+        version,
+        [self = shared_from_this(), phone, password, answer, token, handler]
+        (connection_result result)
+        {
+            switch (result)
+            {
+            case connection_result::MUST_BE_UPDATE:
+            case connection_result::SERVER_INCOMPATIBLE_VERSION:
+            case connection_result::NOT_CONNECTED:
+                handler(result, autorize_result::DISCONNECTED);
+                return;
+            case connection_result::FAILED:
+                handler(result, autorize_result::FAILED);
+                return;
+            default:
+                break;
+            }
+
+            if (answer->empty())
+            {
+                self->async_autorize_on_server(phone, password,
+                    [handler, result](autorize_result autorize)
+                    { handler(result, autorize); });
+                return;
+            }
+
+            handler(result, self->combined_autorize_result(phone, password,
+                                                           *answer,
+                                                           move(*token)));
+        });
+}
+
+future<pair<client::connection_result, client::autorize_result>>
+client::async_connect_to_server(string address, uint16_t port, string phone,
+                                string password)
+{
+    using results = pair<connection_result, autorize_result>;
+    return make_future<results>(
+        [&](function<void(results)> handler)
+        {
+            async_connect_to_server(move(address), port, move(phone),
+                                    move(password),
+                                    [handler](connection_result result,
+                                              autorize_result autorize)
+                                    { handler({result, autorize}); });
+        });
+}
+
+bool client::open_connection(string address, uint16_t port,
+                             unique_ptr<get_version_request> r,
+                             shared_ptr<version_type> version,
+                             connection_result &result)
+{
     con->connect(address, port);
     con->wait_connection();
     if (!con->is_connected())
@@ -71,12 +398,10 @@ bool client::connect_to_server(string address, uint16_t port,
         return false;
     }
 
-    auto version = make_shared<version_type>();
-    auto r = make_unique<get_version_request>(version);
-    con->send_request(move(r));
+    auto id = con->send_request(move(r));
     try
     {
-        con->wait_answer();
+        con->wait_answer(id);
     }
     catch (connection::communication_exception&)
     {
@@ -89,27 +414,79 @@ bool client::connect_to_server(string address, uint16_t port,
         return false;
     }
 
-    if (MAJOR != version->major)
+    result = check_server_version(*version);
+    return result != connection_result::MUST_BE_UPDATE &&
+           result != connection_result::SERVER_INCOMPATIBLE_VERSION;
+}
+
+void client::async_open_connection(string address, uint16_t port,
+                                   version_request_factory make_request,
+                                   shared_ptr<version_type> version,
+                                   connection_handler handler)
+{
+    auto self = shared_from_this();
+    con->connect(address, port,
+                 [self, make_request, version, handler](bool connected)
     {
-        result = MAJOR < version->major ? connection_result::MUST_BE_UPDATE :
-            connection_result::SERVER_INCOMPATIBLE_VERSION;
-        con->close_connection();
-        return false;
-    }
+        if (!connected)
+        {
+            handler(connection_result::NOT_CONNECTED);
+            return;
+        }
 
-    result = connection_result::OK;
-    if (MINOR < version->minor)
+        self->con->send_request(make_request(),
+            [self, version, handler](connection::answer_state state)
+            {
+                switch (state)
+                {
+                case connection::answer_state::READY:
+                    handler(self->check_server_version(*version));
+                    break;
+                case connection::answer_state::DISCONNECTED:
+                    handler(connection_result::NOT_CONNECTED);
+                    break;
+                default:
+                    handler(connection_result::FAILED);
+                    break;
+                }
+            });
+    });
+}
+
+client::autorize_result client::combined_autorize_result(string phone,
+                                                         string password,
+                                                         const string &answer,
+                                                         string token)
+{
+    auto result = account_result(autorize_answers, answer);
+    if (result == autorize_result::OK)
     {
-        result = connection_result::SHOULD_BE_UPDATE;
+        remember_session(move(phone), move(password), move(token));
     }
-    else if (MINOR > version->minor)
+    return result;
+}
+
+client::connection_result client::check_server_version(
+        const version_type &version)
+{
+    if (MAJOR != version.major)
     {
-        result = connection_result::SERVER_OLD_VERSION;
+        con->close_connection();
+        return MAJOR < version.major ? connection_result::MUST_BE_UPDATE :
+            connection_result::SERVER_INCOMPATIBLE_VERSION;
     }
 
-    server_version = p2p::to_string(*version);
+    server_version = p2p::to_string(version);
 
-    return true;
+    if (MINOR < version.minor)
+    {
+        return connection_result::SHOULD_BE_UPDATE;
+    }
+    else if (MINOR > version.minor)
+    {
+        return connection_result::SERVER_OLD_VERSION;
+    }
+    return connection_result::OK;
 }
 
 client::version client::get_version()
@@ -148,17 +525,27 @@ client::register_result client::register_on_server(string phone,
                                                    string password,
                                                    string code)
 {
-    static unordered_map<string, client::register_result> answer_dict =
-    {
-        {"OK", register_result::OK},
-        {"NEED_CODE", register_result::NEED_CODE},
-        {"INVALID_CODE", register_result::INVALID_CODE},
-        {"ALREADY_EXISTS", register_result::ALREADY_EXISTS}
-    };
+    auto result_ptr = make_shared<string>();
+    auto r = make_unique<register_request>(phone, password, code, result_ptr);
+    return account_operation(register_answers, std::move(r), result_ptr);
+}
 
+void client::async_register_on_server(string phone, string password,
+                                      string code, register_handler handler)
+{
     auto result_ptr = make_shared<string>();
     auto r = make_unique<register_request>(phone, password, code, result_ptr);
-    return account_operation(answer_dict, std::move(r), result_ptr);
+    async_account_operation(register_answers, std::move(r), result_ptr,
+                            move(handler));
+}
+
+future<client::register_result> client::async_register_on_server(
+        string phone, string password, string code)
+{
+    return make_future<register_result>(
+        [&](register_handler handler)
+        { async_register_on_server(move(phone), move(password), move(code),
+                                   move(handler)); });
 }
 
 string client::to_string(client::unregister_result v)
@@ -186,17 +573,27 @@ string client::to_string(client::unregister_result v)
 client::unregister_result client::unregister_on_server(string phone,
                                                        string password)
 {
-    static unordered_map<string, client::unregister_result> answer_dict =
-    {
-        {"OK", unregister_result::OK},
-        {"INVALID_ACTION", unregister_result::INVALID_ACTION},
-        {"INVALID_PHONE", unregister_result::INVALID_PHONE},
-        {"INVALID_PASSWORD", unregister_result::INVALID_PASSWORD}
-    };
+    auto result_ptr = make_shared<string>();
+    auto r = make_unique<unregister_request>(phone, password, result_ptr);
+    return account_operation(unregister_answers, std::move(r), result_ptr);
+}
 
+void client::async_unregister_on_server(string phone, string password,
+                                        unregister_handler handler)
+{
     auto result_ptr = make_shared<string>();
     auto r = make_unique<unregister_request>(phone, password, result_ptr);
-    return account_operation(answer_dict, std::move(r), result_ptr);
+    async_account_operation(unregister_answers, std::move(r), result_ptr,
+                            move(handler));
+}
+
+future<client::unregister_result> client::async_unregister_on_server(
+        string phone, string password)
+{
+    return make_future<unregister_result>(
+        [&](unregister_handler handler)
+        { async_unregister_on_server(move(phone), move(password),
+                                     move(handler)); });
 }
 
 string client::to_string(client::autorize_result v)
@@ -224,17 +621,557 @@ string client::to_string(client::autorize_result v)
 client::autorize_result client::autorize_on_server(string phone,
                                                    string password)
 {
-    static unordered_map<string, client::autorize_result> answer_dict =
+    auto result_ptr = make_shared<string>();
+    auto token = make_shared<string>();
+    auto r = make_unique<autorize_request>(phone, password, result_ptr, token);
+    auto result = account_operation(autorize_answers, std::move(r), result_ptr);
+    if (result == autorize_result::OK)
     {
-        {"OK", autorize_result::OK},
-        {"INVALID_ACTION", autorize_result::INVALID_ACTION},
-        {"INVALID_PHONE", autorize_result::INVALID_PHONE},
-        {"INVALID_PASSWORD", autorize_result::INVALID_PASSWORD}
-    };
+        remember_session(move(phone), move(password), move(*token));
+    }
+    return result;
+}
+
+void client::async_autorize_on_server(string phone, string password,
+                                      autorize_handler handler)
+{
+    auto result_ptr = make_shared<string>();
+    auto token = make_shared<string>();
+    auto r = make_unique<autorize_request>(phone, password, result_ptr, token);
+    async_account_operation(autorize_answers, std::move(r), result_ptr,
+        [self = shared_from_this(), phone, password, token, handler]
+        (autorize_result result)
+        {
+            if (result == autorize_result::OK)
+            {
+                self->remember_session(phone, password, *token);
+            }
+            handler(result);
+        });
+}
+
+future<client::autorize_result> client::async_autorize_on_server(
+        string phone, string password)
+{
+    return make_future<autorize_result>(
+        [&](autorize_handler handler)
+        { async_autorize_on_server(move(phone), move(password),
+                                   move(handler)); });
+}
+
+client::contacts_dictionary client::get_contacts(const phones_list &phones)
+{
+    using batch = pair<request_id_type, shared_ptr<contacts_dictionary>>;
+    deque<batch> batches;
+    contacts_dictionary contacts;
+    contacts.reserve(phones.size());
+
+    size_t begin = 0;
+    try
+    {
+        while (begin < phones.size() || !batches.empty())
+        {
+            while (begin < phones.size() &&
+                   batches.size() < CONTACTS_BATCHES_IN_FLIGHT)
+            {
+                size_t end = contacts_batch_end(phones, begin);
+                auto result_ptr = make_shared<contacts_dictionary>();
+                auto r = make_unique<get_contacts_request>(
+                    phones_list(phones.begin() + begin, phones.begin() + end),
+                    result_ptr);
+                batches.emplace_back(con->send_request(move(r)), result_ptr);
+                begin = end;
+            }
+
+            con->wait_answer(batches.front().first);
+            const contacts_dictionary &result = *batches.front().second;
+            contacts.insert(result.begin(), result.end());
+            batches.pop_front();
+        }
+    }
+    catch (connection::communication_exception&)
+    {
+        contacts.clear();
+    }
+    catch (connection::disconnected_exception&)
+    {
+        contacts.clear();
+    }
+
+    for (const batch &b : batches)
+    {
+        try
+        {
+            con->wait_answer(b.first);
+        }
+        catch (connection::communication_exception&)
+        {
+        }
+        catch (connection::disconnected_exception&)
+        {
+        }
+    }
+    return contacts;
+}
+
+void client::async_get_contacts(const phones_list &phones,
+                                contacts_handler handler)
+{
+    auto contacts = make_shared<contacts_dictionary>();
+    contacts->reserve(phones.size());
+    async_get_contacts(phones,
+        [contacts](const contacts_dictionary &chunk)
+        { contacts->insert(chunk.begin(), chunk.end()); },
+        [contacts, handler](bool completed)
+        {
+            if (!completed)
+            {
+                contacts->clear();
+            }
+            handler(move(*contacts));
+        });
+}
+
+void client::async_get_contacts(phones_list phones,
+                                contacts_chunk_handler on_chunk,
+                                contacts_completion_handler on_complete)
+{
+    auto lookup = make_shared<contacts_lookup>(con, move(phones),
+                                               move(on_chunk),
+                                               move(on_complete));
+    lookup->start();
+}
+
+future<client::contacts_dictionary> client::async_get_contacts(
+        const phones_list &phones)
+{
+    return make_future<contacts_dictionary>(
+        [&](contacts_handler handler)
+        { async_get_contacts(phones, move(handler)); });
+}
+
+void client::open_contacts_cache(const string &path)
+{
+    atomic_store(&cache, make_shared<contacts_cache>(path));
+}
+
+void client::open_outbox(const string &path)
+{
+    auto b = make_shared<outbox>(path);
+    message_id_type stored = b->last_message_id();
+    message_id_type current = last_message_id;
+    while (current < stored &&
+           !last_message_id.compare_exchange_weak(current, stored))
+    {
+    }
+    atomic_store(&box, b);
+    peers->set_outbox(b);
+
+    bool autorized;
+    {
+        lock_guard<mutex> lck(session_mutex);
+        autorized = !session_phone.empty();
+    }
+    if (autorized)
+    {
+        peers->resend_outbox();
+    }
+}
+
+bool client::sync_contacts()
+{
+    auto c = atomic_load(&cache);
+    if (!c)
+    {
+        return false;
+    }
+
+    while (true)
+    {
+        auto delta = make_shared<contacts_delta>();
+        auto id = con->send_request(
+            make_unique<sync_contacts_request>(c->version(), c->hash(), delta));
+        try
+        {
+            con->wait_answer(id);
+        }
+        catch (connection::communication_exception&)
+        {
+            return false;
+        }
+        catch (connection::disconnected_exception&)
+        {
+            return false;
+        }
+
+        if (!c->apply(*delta))
+        {
+            return false;
+        }
+        if (delta->complete)
+        {
+            return true;
+        }
+    }
+}
+
+void client::async_sync_contacts(sync_handler handler)
+{
+    auto c = atomic_load(&cache);
+    if (!c)
+    {
+        handler(false);
+        return;
+    }
+    async_sync_contacts(c, move(handler));
+}
+
+void client::async_sync_contacts(shared_ptr<contacts_cache> c,
+                                 sync_handler handler)
+{
+    auto delta = make_shared<contacts_delta>();
+    auto self = shared_from_this();
+    con->send_request(
+        make_unique<sync_contacts_request>(c->version(), c->hash(), delta),
+        [self, c, delta, handler](connection::answer_state state)
+        {
+            if (state != connection::answer_state::READY || !c->apply(*delta))
+            {
+                handler(false);
+            }
+            else if (delta->complete)
+            {
+                handler(true);
+            }
+            else
+            {
+                self->async_sync_contacts(c, handler);
+            }
+        });
+}
+
+client::contacts_dictionary client::get_cached_contacts() const
+{
+    auto c = atomic_load(&cache);
+    return c ? c->contacts() : contacts_dictionary{};
+}
+
+size_t client::poll()
+{
+    return pool->poll();
+}
+
+size_t client::run_one()
+{
+    return pool->run_one();
+}
+
+size_t client::run_for(chrono::milliseconds timeout)
+{
+    return pool->run_for(timeout);
+}
+
+void client::close_all_connections()
+{
+    peers->close_all();
+    con->close_connection();
+}
+
+void client::set_answer_timeout(request_type type,
+                                std::chrono::milliseconds timeout)
+{
+    opcode command = opcode::GET_VERSION;
+    switch (type)
+    {
+    case request_type::GET_VERSION: command = opcode::GET_VERSION; break;
+    case request_type::REGISTER: command = opcode::REGISTER; break;
+    case request_type::UNREGISTER: command = opcode::UNREGISTER; break;
+    case request_type::AUTORIZE: command = opcode::AUTORIZE; break;
+    case request_type::GET_CONTACTS: command = opcode::GET_CONTACTS; break;
+    case request_type::SYNC_CONTACTS: command = opcode::SYNC_CONTACTS; break;
+    }
+    con->set_answer_timeout(command, timeout);
+}
+
+std::chrono::microseconds client::get_server_rtt() const
+{
+    return con->rtt();
+}
+
+void client::set_keepalive(std::chrono::milliseconds interval,
+                           std::chrono::milliseconds timeout)
+{
+    con->set_keepalive(interval, timeout);
+}
+
+void client::set_reconnect(bool enabled, std::chrono::milliseconds min_delay,
+                           std::chrono::milliseconds max_delay)
+{
+    con->set_reconnect(enabled, min_delay, max_delay);
+}
+
+void client::set_datagram_transport(bool enabled)
+{
+    peers->set_datagram_transport(enabled);
+}
+
+void client::set_datagram_loss(double probability)
+{
+    peers->set_datagram_loss(probability);
+}
+
+void client::set_range_events(bool enabled)
+{
+    peers->set_range_events(enabled);
+}
+
+void client::remember_session(string phone, string password, string token)
+{
+    lock_guard<mutex> lck(session_mutex);
+    session_phone = move(phone);
+    session_password = move(password);
+    session_token = move(token);
+    peers->resend_outbox();
+}
+
+void client::resume_session()
+{
+    string phone;
+    string password;
+    string token;
+    {
+        lock_guard<mutex> lck(session_mutex);
+        phone = session_phone;
+        password = session_password;
+        token = session_token;
+    }
+
+    bool autorized = !phone.empty();
+    bool combined = autorized && token.empty();
+    auto self = shared_from_this();
+    auto version = make_shared<version_type>();
+    auto answer = make_shared<string>();
+    auto new_token = make_shared<string>();
+    auto r = combined ?
+                make_unique<get_version_request>(version, phone, password,
+                                                 answer, new_token) :
+                make_unique<get_version_request>(version);
+    con->send_request(move(r),
+        [self, version, autorized, combined, answer, new_token]
+        (connection::answer_state state)
+        {
+            if (state == connection::answer_state::FAILED)
+            {
+                self->con->close_connection();
+                return;
+            }
+            if (state != connection::answer_state::READY)
+            {
+                return;
+            }
+
+            auto result = self->check_server_version(*version);
+            if (result == connection_result::MUST_BE_UPDATE ||
+                result == connection_result::SERVER_INCOMPATIBLE_VERSION)
+            {
+                return;
+            }
+
+            if (!autorized)
+            {
+                self->con->reconnected();
+            }
+            else if (combined && answer->empty())
+            {
+                self->restore_autorization();
+            }
+            else if (combined)
+            {
+                if (account_result(autorize_answers, *answer) !=
+                    autorize_result::OK)
+                {
+                    self->con->close_connection();
+                    return;
+                }
+
+                {
+                    lock_guard<mutex> lck(self->session_mutex);
+                    self->session_token = move(*new_token);
+                }
+                self->con->reconnected();
+            }
+        });
+
+    if (!autorized || combined)
+    {
+        return;
+    }
+
+    con->send_request(make_unique<resume_request>(token, answer, new_token),
+        [self, answer, new_token](connection::answer_state state)
+        {
+            if (state == connection::answer_state::DISCONNECTED)
+            {
+                return;
+            }
+
+            if (state == connection::answer_state::READY &&
+                account_result(autorize_answers, *answer) ==
+                    autorize_result::OK)
+            {
+                {
+                    lock_guard<mutex> lck(self->session_mutex);
+                    if (!new_token->empty())
+                    {
+                        self->session_token = move(*new_token);
+                    }
+                }
+                self->con->reconnected();
+                return;
+            }
+
+            self->restore_autorization();
+        });
+}
+
+void client::restore_autorization()
+{
+    string phone;
+    string password;
+    {
+        lock_guard<mutex> lck(session_mutex);
+        phone = session_phone;
+        password = session_password;
+    }
 
     auto result_ptr = make_shared<string>();
-    auto r = make_unique<autorize_request>(phone, password, result_ptr);
-    return account_operation(answer_dict, std::move(r), result_ptr);
+    auto token = make_shared<string>();
+    auto r = make_unique<autorize_request>(phone, password, result_ptr, token);
+    con->send_request(move(r),
+        [self = shared_from_this(), result_ptr, token]
+        (connection::answer_state state)
+        {
+            if (state == connection::answer_state::DISCONNECTED)
+            {
+                return;
+            }
+
+            if (state == connection::answer_state::READY &&
+                account_result(autorize_answers, *result_ptr) ==
+                    autorize_result::OK)
+            {
+                {
+                    lock_guard<mutex> lck(self->session_mutex);
+                    self->session_token = move(*token);
+                }
+                self->con->reconnected();
+                return;
+            }
+
+            self->con->close_connection();
+        });
+}
+
+event::ptr client::get_event()
+{
+    event::ptr e;
+    if (pool->is_caller_driven())
+    {
+        wait_event();
+        events->try_pop(e);
+    }
+    else
+    {
+        events->pop(e, [this]{ return !con->is_connected() &&
+                                      !con->is_reconnecting(); });
+    }
+
+    if (!e)
+    {
+        e = make_event<disconnected_event>();
+    }
+    return e;
+}
+
+size_t client::get_events(vector<event::ptr> &batch, size_t max)
+{
+    size_t count;
+    if (pool->is_caller_driven())
+    {
+        wait_event();
+        count = events->pop(batch, max, []{ return true; });
+    }
+    else
+    {
+        count = events->pop(batch, max, [this]{ return !con->is_connected() &&
+                                                   !con->is_reconnecting(); });
+    }
+
+    if (count == 0 && max != 0)
+    {
+        batch.push_back(make_event<disconnected_event>());
+        count = 1;
+    }
+    return count;
+}
+
+void client::wait_event()
+{
+    while (events->empty() &&
+           (con->is_connected() || con->is_reconnecting()))
+    {
+        pool->run_one();
+    }
+}
+
+message_id_type client::send_message(friend_id_type friend_id,
+                                     const string &message)
+{
+    return send_message(friend_id, make_shared<const string>(message));
+}
+
+message_id_type client::send_message(friend_id_type friend_id,
+                                     message_buffer message)
+{
+    message_id_type message_id = ++last_message_id;
+    if (auto b = atomic_load(&box))
+    {
+        b->append(friend_id, message_id, *message);
+    }
+    peers->send_message(friend_id, message_id, move(message));
+    return message_id;
+}
+
+void client::connect_to_client(friend_id_type friend_id)
+{
+    peers->connect_to_client(friend_id);
+}
+
+void client::confirm_connection(friend_id_type friend_id)
+{
+    peers->confirm_connection(friend_id);
+}
+
+void client::discard_connection(friend_id_type friend_id)
+{
+    peers->discard_connection(friend_id);
+}
+
+void client::close_client_connection(friend_id_type friend_id)
+{
+    peers->close_client_connection(friend_id);
+}
+
+void client::confirm_reading(friend_id_type friend_id,
+                             message_id_type message_id)
+{
+    peers->confirm_reading(friend_id, message_id);
+}
+
+void client::confirm_reading_up_to(friend_id_type friend_id,
+                                   message_id_type message_id)
+{
+    peers->confirm_reading(friend_id, message_id, true);
 }
 
 }//p2p
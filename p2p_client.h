@@ -8,11 +8,24 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <memory>
+#include <functional>
+#include <future>
+#include <utility>
+#include <atomic>
+#include <mutex>
+#include <chrono>
 
 #include "p2p_common.h"
 #include "p2p_events.h"
 #include "p2p_connection.h"
+#include "p2p_service_pool.h"
+#include "p2p_event_queue.h"
+#include "p2p_event_dispatcher.h"
+#include "p2p_contacts_cache.h"
+#include "p2p_outbox.h"
+#include "p2p_peer_manager.h"
 
 /**
  * \mainpage Index page
@@ -31,9 +44,10 @@ namespace p2p
  */
 class client : public std::enable_shared_from_this<client>
 {
-    client();
+    explicit client(service_pool::ptr pool);
 
 public:
+    ~client();
     /**
      * @brief Умный указатель (с подсчётом ссылок) на объект класса
      */
@@ -42,11 +56,45 @@ public:
      * @brief Создать объект
      *
      * Конструктор класса является приватным, прямое создание запрещено
-     * из-за особенностей функционирования класса std::enable_shared_from_this
+     * из-за особенностей функционирования класса std::enable_shared_from_this;
+     * по умолчанию каждый клиент обслуживается собственным потоком,
+     * при передаче общего пула потоков (service_pool::create) множество
+     * клиентов обслуживается одним набором потоков, при этом обработка
+     * каждого соединения остаётся последовательной
      *
+     * @param[in] pool Пул потоков, обслуживающих соединение клиента;
+     *                 если не задан, создаётся собственный пул из одного
+     *                 потока; пул без потоков (service_pool::create(0))
+     *                 включает режим опроса: фоновые потоки не создаются,
+     *                 приложение само вызывает client::poll,
+     *                 client::run_one или client::run_for, а блокирующие
+     *                 методы обрабатывают сетевые операции в вызывающем
+     *                 потоке
      * @return Указатель на созданный объект класса
      */
-    static ptr create();
+    static ptr create(service_pool::ptr pool = nullptr);
+
+    /**
+     * @brief Выполнить все готовые к выполнению сетевые операции;
+     * неблокирующий метод
+     *
+     * Предназначен для режима опроса; обработчики асинхронных методов и
+     * событий вызываются в вызывающем потоке
+     *
+     * @return Количество выполненных операций
+     */
+    size_t poll();
+    /**
+     * @brief Дождаться и выполнить одну сетевую операцию; метод блокирующий
+     * @return Количество выполненных операций (0 или 1)
+     */
+    size_t run_one();
+    /**
+     * @brief Выполнять сетевые операции в течение заданного времени
+     * @param[in] timeout Время выполнения
+     * @return Количество выполненных операций
+     */
+    size_t run_for(std::chrono::milliseconds timeout);
 
     /**
      * @brief Результат выполнения попытки подключения к серверу
@@ -83,6 +131,31 @@ public:
      */
     bool connect_to_server(std::string address, uint16_t port,
                            connection_result &result);
+    /**
+     * @brief Обработчик результата асинхронной попытки подключения к серверу
+     */
+    using connection_handler = std::function<void(connection_result)>;
+    /**
+     * @brief Установить соединение с сервером; неблокирующий метод
+     *
+     * Асинхронный вариант client::connect_to_server; обработчик вызывается
+     * из потока обслуживания соединения после проверки версии сервера
+     *
+     * @param[in] address Адрес сервера
+     * @param[in] port Порт сервера
+     * @param[in] handler Обработчик результата попытки подключения
+     */
+    void async_connect_to_server(std::string address, uint16_t port,
+                                 connection_handler handler);
+    /**
+     * @brief Установить соединение с сервером; неблокирующий метод
+     * @param[in] address Адрес сервера
+     * @param[in] port Порт сервера
+     * @return Результат попытки подключения (будет доступен после
+     * завершения подключения)
+     */
+    std::future<connection_result> async_connect_to_server(std::string address,
+                                                           uint16_t port);
 
     /**
      * @brief Версия программного обеспечения сервера и клиента
@@ -144,6 +217,25 @@ public:
     register_result register_on_server(std::string phone,
                                        std::string password,
                                        std::string code);
+    /**
+     * @brief Обработчик результата асинхронной попытки регистрации
+     */
+    using register_handler = std::function<void(register_result)>;
+    /**
+     * @brief Зарегестрироваться на сервере; неблокирующий метод
+     *
+     * Асинхронный вариант client::register_on_server; обработчик вызывается
+     * из потока обслуживания соединения
+     */
+    void async_register_on_server(std::string phone, std::string password,
+                                  std::string code, register_handler handler);
+    /**
+     * @brief Зарегестрироваться на сервере; неблокирующий метод
+     * @return Результат выполнения попытки регистрации на сервере
+     */
+    std::future<register_result> async_register_on_server(std::string phone,
+                                                          std::string password,
+                                                          std::string code);
 
     /**
      * @brief Результат выполнения попытки удаления регистрации с сервера
@@ -174,6 +266,24 @@ public:
      */
     unregister_result unregister_on_server(std::string phone,
                                            std::string password);
+    /**
+     * @brief Обработчик результата асинхронной попытки удаления регистрации
+     */
+    using unregister_handler = std::function<void(unregister_result)>;
+    /**
+     * @brief Удалить регистрацию на сервере; неблокирующий метод
+     *
+     * Асинхронный вариант client::unregister_on_server; обработчик
+     * вызывается из потока обслуживания соединения
+     */
+    void async_unregister_on_server(std::string phone, std::string password,
+                                    unregister_handler handler);
+    /**
+     * @brief Удалить регистрацию на сервере; неблокирующий метод
+     * @return Результат выполнения попытки удаления регистрации с сервера
+     */
+    std::future<unregister_result> async_unregister_on_server(
+            std::string phone, std::string password);
 
     /**
      * @brief Результат выполнения авторизации на сервере
@@ -198,6 +308,84 @@ public:
      * @return Результат выполнения авторизации на сервере
      */
     autorize_result autorize_on_server(std::string phone, std::string password);
+    /**
+     * @brief Обработчик результата асинхронной авторизации
+     */
+    using autorize_handler = std::function<void(autorize_result)>;
+    /**
+     * @brief Авторизация на сервере; неблокирующий метод
+     *
+     * Асинхронный вариант client::autorize_on_server; обработчик вызывается
+     * из потока обслуживания соединения
+     */
+    void async_autorize_on_server(std::string phone, std::string password,
+                                  autorize_handler handler);
+    /**
+     * @brief Авторизация на сервере; неблокирующий метод
+     * @return Результат выполнения авторизации на сервере
+     */
+    std::future<autorize_result> async_autorize_on_server(std::string phone,
+                                                          std::string password);
+
+    /**
+     * @brief Установить соединение с сервером и авторизоваться на нём;
+     * блокирующий метод
+     *
+     * Телефон и пароль передаются вместе с запросом версии, поэтому после
+     * установки TCP-соединения требуется только один обмен с сервером;
+     * если сервер не поддерживает совмещённый запрос, после проверки версии
+     * выполняется обычная авторизация (client::autorize_on_server); если
+     * соединение уже установлено, выполняется только авторизация
+     *
+     * @param[in] address Адрес сервера
+     * @param[in] port Порт сервера
+     * @param[in] phone Телефон
+     * @param[in] password Пароль
+     * @param[out] result Результат попытки подключения
+     * @param[out] autorize Результат авторизации; если подключение не
+     * было установлено - autorize_result::DISCONNECTED или
+     * autorize_result::FAILED
+     * @return Успешность подключения к серверу
+     */
+    bool connect_to_server(std::string address, uint16_t port,
+                           std::string phone, std::string password,
+                           connection_result &result,
+                           autorize_result &autorize);
+    /**
+     * @brief Обработчик результата асинхронной попытки подключения к серверу
+     * с авторизацией
+     */
+    using connection_autorize_handler =
+            std::function<void(connection_result, autorize_result)>;
+    /**
+     * @brief Установить соединение с сервером и авторизоваться на нём;
+     * неблокирующий метод
+     *
+     * Асинхронный вариант client::connect_to_server с авторизацией;
+     * обработчик вызывается из потока обслуживания соединения
+     *
+     * @param[in] address Адрес сервера
+     * @param[in] port Порт сервера
+     * @param[in] phone Телефон
+     * @param[in] password Пароль
+     * @param[in] handler Обработчик результатов подключения и авторизации
+     */
+    void async_connect_to_server(std::string address, uint16_t port,
+                                 std::string phone, std::string password,
+                                 connection_autorize_handler handler);
+    /**
+     * @brief Установить соединение с сервером и авторизоваться на нём;
+     * неблокирующий метод
+     * @param[in] address Адрес сервера
+     * @param[in] port Порт сервера
+     * @param[in] phone Телефон
+     * @param[in] password Пароль
+     * @return Результаты подключения и авторизации (будут доступны после
+     * их завершения)
+     */
+    std::future<std::pair<connection_result, autorize_result>>
+    async_connect_to_server(std::string address, uint16_t port,
+                            std::string phone, std::string password);
 
     /**
      * @brief Закрытие соединение с сервером и всеми контактами;
@@ -209,6 +397,121 @@ public:
      */
     void close_all_connections();
 
+    /**
+     * @brief Тип запроса к серверу, ожидающего ответа
+     */
+    enum class request_type
+    {
+        GET_VERSION, ///< получение версии сервера
+        REGISTER, ///< регистрация
+        UNREGISTER, ///< удаление регистрации
+        AUTORIZE, ///< авторизация
+        GET_CONTACTS, ///< получение идентификаторов контактов
+        SYNC_CONTACTS, ///< синхронизация кэша контактов
+    };
+    /**
+     * @brief Задать время ожидания ответа сервера для запросов заданного
+     * типа; неблокирующий метод
+     *
+     * Время отсчитывается от момента отправки запроса; если ответ не
+     * получен за это время, соединение закрывается (генерируется событие
+     * disconnected_event); по умолчанию (и при нулевом значении) время
+     * ожидания вычисляется по сглаженной оценке RTT и её разбросу, как
+     * RTO в TCP (от 200 мс до 60 с; до первого ответа сервера - 5 с)
+     *
+     * @param[in] type Тип запроса
+     * @param[in] timeout Время ожидания ответа; ноль - адаптивное время
+     */
+    void set_answer_timeout(request_type type,
+                            std::chrono::milliseconds timeout);
+    /**
+     * @brief Возвращает текущую сглаженную оценку времени от отправки
+     * запроса до получения ответа сервера (RTT); неблокирующий метод
+     * @return Оценка RTT; ноль, если ещё не получено ни одного ответа
+     */
+    std::chrono::microseconds get_server_rtt() const;
+    /**
+     * @brief Включить проверку доступности сервера; неблокирующий метод
+     *
+     * Если от сервера ничего не было получено в течение интервала и нет
+     * других запросов, ожидающих ответа, серверу отправляется запрос PING;
+     * если ответ не получен за время ожидания, соединение закрывается
+     * (генерируется событие disconnected_event); таким образом разрыв
+     * соединения обнаруживается не позже чем через интервал плюс время
+     * ожидания; сервер должен поддерживать запрос PING
+     *
+     * @param[in] interval Интервал проверки; ноль - проверка отключена
+     * (по умолчанию)
+     * @param[in] timeout Время ожидания ответа на PING; ноль - адаптивное
+     * время, как в set_answer_timeout
+     */
+    void set_keepalive(std::chrono::milliseconds interval,
+                       std::chrono::milliseconds timeout =
+                            std::chrono::milliseconds::zero());
+    /**
+     * @brief Включить или отключить автоматическое переподключение к
+     * серверу; неблокирующий метод
+     *
+     * При разрыве соединения запросы, ожидающие ответа, завершаются как
+     * при обычном разрыве, но событие disconnected_event не генерируется:
+     * попытки подключения повторяются с экспоненциально растущей
+     * задержкой, выбираемой случайно от нуля до текущего предела (чтобы
+     * клиенты не переподключались одновременно после перезапуска сервера);
+     * после подключения проверяется версия сервера и восстанавливается
+     * авторизация - по токену сессии, выданному сервером при авторизации,
+     * а если сервер его не выдал или отверг, повторной авторизацией с
+     * прежними телефоном и паролем; по завершении генерируется событие
+     * reconnected_event; при несовместимой версии сервера или ошибке
+     * авторизации переподключение прекращается и генерируется событие
+     * disconnected_event; close_all_connections также прекращает
+     * переподключение
+     *
+     * @param[in] enabled Включить переподключение (по умолчанию отключено)
+     * @param[in] min_delay Предел задержки перед первой попыткой
+     * @param[in] max_delay Максимальный предел задержки
+     */
+    void set_reconnect(bool enabled,
+                       std::chrono::milliseconds min_delay =
+                            std::chrono::milliseconds{500},
+                       std::chrono::milliseconds max_delay =
+                            std::chrono::milliseconds{30000});
+    /**
+     * @brief Выбрать транспорт прямых соединений с контактами;
+     * неблокирующий метод
+     *
+     * По умолчанию используется UDP с нумерацией пакетов, выборочными
+     * подтверждениями, быстрой повторной передачей и равномерной отправкой;
+     * потеря одного пакета задерживает только сообщение, которому он
+     * принадлежит; транспорт выбирает сторона, подтверждающая соединение
+     * (client::confirm_connection), вызывающая сторона следует её выбору
+     *
+     * @param[in] enabled true - UDP, false - TCP
+     */
+    void set_datagram_transport(bool enabled);
+    /**
+     * @brief Отбрасывать случайную долю исходящих UDP-пакетов прямых
+     * соединений; предназначен для тестирования; неблокирующий метод
+     *
+     * Действует на соединения, установленные после вызова
+     *
+     * @param[in] probability Вероятность потери пакета от 0 до 1
+     */
+    void set_datagram_loss(double probability);
+    /**
+     * @brief Получать одно событие на подтверждённый диапазон сообщений;
+     * неблокирующий метод
+     *
+     * Подтверждения доставки и прочтения передаются накопительно
+     * ("все сообщения до N"); по умолчанию для каждого сообщения диапазона
+     * генерируется отдельное событие friend_message_delivered_event или
+     * friend_message_readed_event, при включённом режиме генерируется одно
+     * событие с границами диапазона (first_message_id и message_id)
+     *
+     * @param[in] enabled Включить события диапазонов (по умолчанию
+     * отключено)
+     */
+    void set_range_events(bool enabled);
+
     /**
      * @brief Список телефонов
      */
@@ -219,11 +522,15 @@ public:
      *
      * Ключ - телефон, значение - уникальный идентификатор
      */
-    using contacts_dictionary = std::map<std::string, friend_id_type>;
+    using contacts_dictionary = std::unordered_map<std::string, friend_id_type>;
     /**
      * @brief Запросить уникальные идентификаторы пользователей по их номерам
      * телефона; метод блокирующий
      *
+     * Список телефонов разбивается на пакеты, помещающиеся в один запрос;
+     * несколько пакетов передаются серверу одновременно, не дожидаясь
+     * ответов на предыдущие
+     *
      * @param[in] phones Список телефонов
      * @return Ассоциативный массив, содержащий в качестве ключей номера
      * телефонов контактов, а в качестве значений уникальные идентификаторы
@@ -234,6 +541,108 @@ public:
      * значение будет пустым
      */
     contacts_dictionary get_contacts(const phones_list &phones);
+    /**
+     * @brief Обработчик результата асинхронного запроса идентификаторов
+     * контактов
+     */
+    using contacts_handler = std::function<void(contacts_dictionary)>;
+    /**
+     * @brief Запросить уникальные идентификаторы пользователей по их номерам
+     * телефона; неблокирующий метод
+     *
+     * Асинхронный вариант client::get_contacts; обработчик вызывается
+     * из потока обслуживания соединения
+     */
+    void async_get_contacts(const phones_list &phones,
+                            contacts_handler handler);
+    /**
+     * @brief Запросить уникальные идентификаторы пользователей по их номерам
+     * телефона; неблокирующий метод
+     * @return Ассоциативный массив идентификаторов контактов
+     */
+    std::future<contacts_dictionary> async_get_contacts(
+            const phones_list &phones);
+    /**
+     * @brief Обработчик очередной части результата потокового запроса
+     * идентификаторов контактов
+     */
+    using contacts_chunk_handler =
+        std::function<void(const contacts_dictionary &chunk)>;
+    /**
+     * @brief Обработчик завершения потокового запроса идентификаторов
+     * контактов; параметр показывает, были ли обработаны все телефоны
+     */
+    using contacts_completion_handler = std::function<void(bool completed)>;
+    /**
+     * @brief Запросить уникальные идентификаторы пользователей по их номерам
+     * телефона, получая результат по частям; неблокирующий метод
+     *
+     * Предназначен для больших адресных книг: одновременно передаётся
+     * ограниченное количество пакетов, результат каждого пакета сразу
+     * передаётся обработчику и не накапливается; обработчики вызываются
+     * из потока обслуживания соединения
+     *
+     * @param[in] phones Список телефонов
+     * @param[in] on_chunk Обработчик результата очередного пакета
+     * @param[in] on_complete Обработчик завершения запроса; вызывается
+     *                        ровно один раз
+     */
+    void async_get_contacts(phones_list phones, contacts_chunk_handler on_chunk,
+                            contacts_completion_handler on_complete);
+
+    /**
+     * @brief Открыть локальный кэш идентификаторов контактов
+     *
+     * Кэш хранится в файле и отображается в память; если файл не существует
+     * или повреждён, кэш считается пустым и будет полностью заполнен при
+     * первой синхронизации
+     *
+     * @param[in] path Путь к файлу кэша
+     */
+    void open_contacts_cache(const std::string &path);
+    /**
+     * @brief Открыть локальную очередь исходящих сообщений
+     *
+     * Очередь хранится в файле и отображается в память; каждое отправляемое
+     * сообщение записывается в неё до передачи в сеть и удаляется после
+     * подтверждения доставки. Недоставленные сообщения повторно
+     * отправляются после открытия очереди, авторизации и восстановления
+     * соединения; получатель отбрасывает повторы по идентификатору
+     * сообщения. Если файл не существует или повреждён, очередь считается
+     * пустой
+     *
+     * @param[in] path Путь к файлу очереди
+     */
+    void open_outbox(const std::string &path);
+    /**
+     * @brief Синхронизировать кэш идентификаторов контактов с сервером;
+     * метод блокирующий
+     *
+     * Серверу передаются только версия и контрольная сумма кэша, в ответ
+     * приходят только изменения, произошедшие после этой версии
+     *
+     * @return Успешность синхронизации; false, если кэш не открыт,
+     * соединение с сервером не установлено или было разорвано
+     */
+    bool sync_contacts();
+    /**
+     * @brief Обработчик результата асинхронной синхронизации кэша
+     */
+    using sync_handler = std::function<void(bool)>;
+    /**
+     * @brief Синхронизировать кэш идентификаторов контактов с сервером;
+     * неблокирующий метод
+     *
+     * Асинхронный вариант client::sync_contacts; обработчик вызывается
+     * из потока обслуживания соединения
+     */
+    void async_sync_contacts(sync_handler handler);
+    /**
+     * @brief Получить содержимое кэша идентификаторов контактов
+     * @return Ассоциативный массив, аналогичный результату
+     * client::get_contacts; пустой, если кэш не открыт
+     */
+    contacts_dictionary get_cached_contacts() const;
 
     /**
      * @brief Запросить необработанное событие; метод блокирующий
@@ -244,6 +653,60 @@ public:
      * @return Указатель на событие
      */
     event::ptr get_event();
+    /**
+     * @brief Запросить несколько необработанных событий за одно ожидание;
+     * метод блокирующий
+     *
+     * Ожидает появления хотя бы одного события, после чего забирает из
+     * очереди все доступные события, но не более max; если очередь пуста,
+     * а соединение с сервером не установлено, в batch будет добавлено
+     * событие disconnected_event
+     *
+     * @param[out] batch Вектор, в конец которого добавляются события
+     * @param[in] max Максимальное количество событий
+     * @return Количество добавленных событий
+     */
+    size_t get_events(std::vector<event::ptr> &batch, size_t max);
+
+    /**
+     * @brief Зарегистрировать обработчик событий заданного типа
+     *
+     * События, для которых зарегистрирован обработчик, не помещаются в
+     * очередь client::get_event, а передаются обработчику сразу после
+     * получения: непосредственно в потоке обслуживания соединения, либо,
+     * если указан пул потоков, в одном из его потоков; повторная регистрация
+     * заменяет предыдущий обработчик
+     *
+     * Пример:
+     * @code
+     * cl->set_event_handler<friend_new_message_event>(
+     *     [](boost::intrusive_ptr<friend_new_message_event> e)
+     *     { show(e->friend_id(), e->message()); });
+     * @endcode
+     *
+     * @tparam Event Тип события (например, friend_connected_event)
+     * @param[in] handler Обработчик, принимающий
+     *                    boost::intrusive_ptr<Event>
+     * @param[in] executor Пул потоков, в котором вызывается обработчик;
+     *                     если не задан, обработчик вызывается в потоке
+     *                     обслуживания соединения и не должен блокироваться
+     */
+    template <typename Event, typename Handler>
+    void set_event_handler(Handler handler,
+                           service_pool::ptr executor = nullptr)
+    {
+        dispatcher->set_handler<Event>(std::move(handler), std::move(executor));
+    }
+    /**
+     * @brief Удалить обработчик событий заданного типа; последующие события
+     * этого типа снова помещаются в очередь client::get_event
+     * @tparam Event Тип события
+     */
+    template <typename Event>
+    void reset_event_handler()
+    {
+        dispatcher->reset_handler<Event>();
+    }
 
     /**
      * @brief Запросить соединение с контактом; неблокирующий метод
@@ -255,6 +718,10 @@ public:
      * friend_discarded_connection_event, friend_connected_event,
      * friend_disconnected_event
      *
+     * После подтверждения клиент пытается установить прямое соединение с
+     * контактом по адресу, полученному от сервера; если это не удаётся,
+     * сообщения передаются через сервер
+     *
      * @param[in] friend_id Уникальный идентификатор контакта
      */
     void connect_to_client(friend_id_type friend_id);
@@ -301,7 +768,8 @@ public:
      *
      * После того как сообщение будет доставлено, генерируется событие
      * friend_message_delivered_event; сообщение может быть недоставлено
-     * только если потеряна связь с контактом;
+     * только если потеряна связь с контактом и не открыта очередь
+     * исходящих сообщений (client::open_outbox);
      * если связь с указанным контактом не было установлена, метод ничего
      * не делает
      *
@@ -312,6 +780,19 @@ public:
      */
     message_id_type send_message(friend_id_type friend_id,
                                  const std::string &message);
+    /**
+     * @brief Послать сообщение контакту без копирования текста
+     *
+     * Аналог client::send_message, текст передаётся в сеть непосредственно
+     * из буфера; буфер не должен изменяться до отправки сообщения
+     *
+     * @param[in] friend_id Уникальный идентификатор контакта
+     * @param[in] message Разделяемый буфер с текстом сообщения
+     * @return Уникальный (для текущего объекта клиента) идентификатор
+     * сообщения
+     */
+    message_id_type send_message(friend_id_type friend_id,
+                                 message_buffer message);
 
     /**
      * @brief Указать, что сообщение прочитано
@@ -324,21 +805,86 @@ public:
      * идентификатор сообщения
      */
     void confirm_reading(friend_id_type friend_id, message_id_type message_id);
+    /**
+     * @brief Указать, что прочитаны все сообщения контакта до указанного
+     * включительно
+     *
+     * Передаётся одним подтверждением независимо от количества сообщений;
+     * собеседнику придёт событие friend_message_readed_event для каждого
+     * прочитанного сообщения или одно событие диапазона
+     * (client::set_range_events)
+     *
+     * @param[in] friend_id Уникальный идентификатор контакта
+     * @param[in] message_id Идентификатор последнего прочитанного сообщения
+     * (friend_new_message_event::message_id)
+     */
+    void confirm_reading_up_to(friend_id_type friend_id,
+                               message_id_type message_id);
 
 private:
+    service_pool::ptr pool;
     connection::ptr con;
+    peer_manager::ptr peers;
+    std::shared_ptr<event_queue> events;
+    std::shared_ptr<event_dispatcher> dispatcher;
+    std::atomic<message_id_type> last_message_id{0};
+    std::shared_ptr<contacts_cache> cache;
+    std::shared_ptr<outbox> box;
+
+    void async_sync_contacts(std::shared_ptr<contacts_cache> cache,
+                             sync_handler handler);
     version client_version;
     version server_version;
 
+    connection_result check_server_version(const version_type &version);
+    bool open_connection(std::string address, uint16_t port,
+                         std::unique_ptr<get_version_request> r,
+                         std::shared_ptr<version_type> version,
+                         connection_result &result);
+    using version_request_factory =
+            std::function<std::unique_ptr<get_version_request>()>;
+    void async_open_connection(std::string address, uint16_t port,
+                               version_request_factory make_request,
+                               std::shared_ptr<version_type> version,
+                               connection_handler handler);
+    autorize_result combined_autorize_result(std::string phone,
+                                             std::string password,
+                                             const std::string &answer,
+                                             std::string token);
+    void wait_event();
+
+    std::mutex session_mutex;
+    std::string session_phone;
+    std::string session_password;
+    std::string session_token;
+    void remember_session(std::string phone, std::string password,
+                          std::string token);
+    void resume_session();
+    void restore_autorization();
+
+    template <typename Dict>
+    static auto account_result(const Dict &answer_dict,
+                               const std::string &answer)
+    {
+        try
+        {
+            return answer_dict.at(answer);
+        }
+        catch (std::out_of_range&)
+        {
+            return Dict::mapped_type::FAILED;
+        }
+    }
+
     template <typename Dict>
     auto account_operation(const Dict &answer_dict,
                            std::unique_ptr<request> req,
                            std::shared_ptr<std::string> answer)
     {
-        con->send_request(move(req));
+        auto id = con->send_request(move(req));
         try
         {
-            con->wait_answer();
+            con->wait_answer(id);
         }
         catch (connection::communication_exception&)
         {
@@ -349,14 +895,41 @@ private:
             return Dict::mapped_type::DISCONNECTED;
         }
 
-        try
-        {
-            return answer_dict.at(*answer);
-        }
-        catch (std::out_of_range&)
-        {
-            return Dict::mapped_type::FAILED;
-        }
+        return account_result(answer_dict, *answer);
+    }
+
+    template <typename Dict, typename Handler>
+    void async_account_operation(const Dict &answer_dict,
+                                 std::unique_ptr<request> req,
+                                 std::shared_ptr<std::string> answer,
+                                 Handler handler)
+    {
+        con->send_request(move(req),
+            [&answer_dict, answer, handler](connection::answer_state state)
+            {
+                switch (state)
+                {
+                case connection::answer_state::READY:
+                    handler(account_result(answer_dict, *answer));
+                    break;
+                case connection::answer_state::DISCONNECTED:
+                    handler(Dict::mapped_type::DISCONNECTED);
+                    break;
+                default:
+                    handler(Dict::mapped_type::FAILED);
+                    break;
+                }
+            });
+    }
+
+    template <typename Result, typename Operation>
+    static std::future<Result> make_future(Operation operation)
+    {
+        auto promise = std::make_shared<std::promise<Result>>();
+        auto future = promise->get_future();
+        operation([promise](Result result)
+                  { promise->set_value(std::move(result)); });
+        return future;
     }
 };
 
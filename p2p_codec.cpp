@@ -0,0 +1,488 @@
+#include "p2p_codec.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string>
+#include <array>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include <p2p_common.h>
+#include "p2p_requests.h"
+#include "p2p_notifications.h"
+#include "p2p_peer_link.h"
+#include "p2p_udp_peer_link.h"
+#include "p2p_scan.h"
+
+using namespace std;
+
+namespace p2p {
+
+namespace
+{
+
+constexpr size_t MAX_VARINT_SIZE = 10;
+
+struct opcodes_table
+{
+    array<string, OPCODES_COUNT> names;
+    unordered_map<string, opcode> codes;
+
+    opcodes_table()
+    {
+        add(opcode::GET_VERSION, GET_VERSION);
+        add(opcode::REGISTER, REGISTER);
+        add(opcode::UNREGISTER, UNREGISTER);
+        add(opcode::AUTORIZE, AUTORIZE);
+        add(opcode::GET_CONTACTS, GET_CONTACTS);
+        add(opcode::SEND_MESSAGE, SEND_MESSAGE);
+        add(opcode::SYNC_CONTACTS, SYNC_CONTACTS);
+        add(opcode::PING, PING);
+        add(opcode::RESUME, RESUME);
+        add(opcode::CONNECT_TO_CLIENT, CONNECT_TO_CLIENT);
+        add(opcode::CONFIRM_CONNECTION, CONFIRM_CONNECTION);
+        add(opcode::DISCARD_CONNECTION, DISCARD_CONNECTION);
+        add(opcode::CLOSE_CLIENT_CONNECTION, CLOSE_CLIENT_CONNECTION);
+        add(opcode::CONFIRM_READING, CONFIRM_READING);
+        add(opcode::FRIEND_STATUS_UPDATED, FRIEND_STATUS_UPDATED);
+        add(opcode::FRIEND_WANTED_TO_CONNECT, FRIEND_WANTED_TO_CONNECT);
+        add(opcode::FRIEND_WANTED_TO_STOP_CONNECTION,
+            FRIEND_WANTED_TO_STOP_CONNECTION);
+        add(opcode::FRIEND_CONFIRMED_CONNECTION, FRIEND_CONFIRMED_CONNECTION);
+        add(opcode::FRIEND_DISCARDED_CONNECTION, FRIEND_DISCARDED_CONNECTION);
+        add(opcode::FRIEND_CONNECTED, FRIEND_CONNECTED);
+        add(opcode::FRIEND_WANTED_TO_DISCONNECT, FRIEND_WANTED_TO_DISCONNECT);
+        add(opcode::FRIEND_DISCONNECTED, FRIEND_DISCONNECTED);
+        add(opcode::FRIEND_NEW_MESSAGE, FRIEND_NEW_MESSAGE);
+        add(opcode::FRIEND_MESSAGE_DELIVERED, FRIEND_MESSAGE_DELIVERED);
+        add(opcode::FRIEND_MESSAGE_READED, FRIEND_MESSAGE_READED);
+        add(opcode::PEER_HELLO, PEER_HELLO);
+        add(opcode::PEER_MESSAGE, PEER_MESSAGE);
+        add(opcode::PEER_DELIVERED, PEER_DELIVERED);
+        add(opcode::PEER_READED, PEER_READED);
+        add(opcode::PEER_BYE, PEER_BYE);
+        add(opcode::PEER_PING, PEER_PING);
+        add(opcode::PEER_PONG, PEER_PONG);
+        add(opcode::PEER_DATA, PEER_DATA);
+        add(opcode::PEER_ACK, PEER_ACK);
+        add(opcode::PEER_DELIVERED_UP_TO, PEER_DELIVERED_UP_TO);
+        add(opcode::PEER_READED_UP_TO, PEER_READED_UP_TO);
+    }
+
+    void add(opcode op, const string &name)
+    {
+        names[static_cast<size_t>(op)] = name;
+        codes[name] = op;
+    }
+};
+
+struct results_table
+{
+    array<string, RESULT_CODES_COUNT> names;
+    unordered_map<string, result_code> codes;
+
+    results_table()
+    {
+        add(result_code::OK, "OK");
+        add(result_code::NEED_CODE, "NEED_CODE");
+        add(result_code::INVALID_CODE, "INVALID_CODE");
+        add(result_code::ALREADY_EXISTS, "ALREADY_EXISTS");
+        add(result_code::INVALID_ACTION, "INVALID_ACTION");
+        add(result_code::INVALID_PHONE, "INVALID_PHONE");
+        add(result_code::INVALID_PASSWORD, "INVALID_PASSWORD");
+    }
+
+    void add(result_code code, const string &name)
+    {
+        names[static_cast<size_t>(code)] = name;
+        codes[name] = code;
+    }
+};
+
+const opcodes_table &opcodes()
+{
+    static const opcodes_table table;
+    return table;
+}
+
+const results_table &results()
+{
+    static const results_table table;
+    return table;
+}
+
+struct text_format
+{
+    char separator = ' ';
+    char terminator = '\n';
+};
+
+text_format probe_text_format()
+{
+    buffer_type buf;
+    size_t size = 0;
+    write_command(buf, size, "A");
+    append_param(buf, size, "B");
+    finalize(buf, size);
+
+    text_format format;
+    string s{buf.data(), size};
+    size_t a = s.find('A');
+    if (a != string::npos && a + 4 == s.size() && s[a + 2] == 'B')
+    {
+        format.separator = s[a + 1];
+        format.terminator = s[a + 3];
+    }
+    return format;
+}
+
+const text_format &text()
+{
+    static const text_format format = probe_text_format();
+    return format;
+}
+
+constexpr size_t MAX_TEXT_FRAME_SIZE = sizeof(buffer_type);
+constexpr size_t MIN_BUFFER_SIZE = 4096;
+
+uint32_t read_frame_size(const char *data)
+{
+    auto p = reinterpret_cast<const unsigned char*>(data);
+    return static_cast<uint32_t>(p[0]) |
+            static_cast<uint32_t>(p[1]) << 8 |
+            static_cast<uint32_t>(p[2]) << 16 |
+            static_cast<uint32_t>(p[3]) << 24;
+}
+
+}
+
+const string &to_string(opcode op)
+{
+    return opcodes().names.at(static_cast<size_t>(op));
+}
+
+const string &to_string(result_code code)
+{
+    return results().names.at(static_cast<size_t>(code));
+}
+
+frame_writer::frame_writer(encoding enc, pooled_buffer &buf, size_t &buf_size) :
+    enc{enc}, buf(buf), buf_size(buf_size), frame_start{buf_size}
+{
+}
+
+void frame_writer::write_command(opcode op)
+{
+    if (enc == encoding::TEXT)
+    {
+        buf.reserve(frame_start + sizeof(buffer_type), frame_start);
+        text_buf = new (buf.data() + frame_start) buffer_type;
+        text_size = 0;
+        p2p::write_command(*text_buf, text_size, to_string(op));
+        return;
+    }
+
+    buf_size = frame_start + BINARY_HEADER_SIZE;
+    char c = static_cast<char>(op);
+    put(&c, 1);
+}
+
+void frame_writer::append_param(const string &param)
+{
+    if (enc == encoding::TEXT)
+    {
+        p2p::append_param(*text_buf, text_size, param);
+        return;
+    }
+
+    put_varint(param.size());
+    put(param.data(), param.size());
+}
+
+void frame_writer::append_uint(uint64_t value)
+{
+    if (enc == encoding::TEXT)
+    {
+        p2p::append_param(*text_buf, text_size, std::to_string(value));
+        return;
+    }
+
+    put_varint(value);
+}
+
+void frame_writer::finalize()
+{
+    if (enc == encoding::TEXT)
+    {
+        p2p::finalize(*text_buf, text_size);
+        buf_size = frame_start + text_size;
+        return;
+    }
+
+    auto size = static_cast<uint32_t>(
+                buf_size - frame_start - BINARY_HEADER_SIZE);
+    for (size_t i = 0; i < BINARY_HEADER_SIZE; ++i)
+    {
+        buf.data()[frame_start + i] = static_cast<char>(size >> (8 * i));
+    }
+}
+
+void frame_writer::put(const char *data, size_t size)
+{
+    if (size > MAX_BINARY_FRAME_SIZE - (buf_size - frame_start))
+    {
+        throw length_error{"frame is too long"};
+    }
+    buf.reserve(buf_size + size, buf_size);
+    memcpy(buf.data() + buf_size, data, size);
+    buf_size += size;
+}
+
+void frame_writer::put_varint(uint64_t value)
+{
+    char bytes[MAX_VARINT_SIZE];
+    size_t size = 0;
+    do
+    {
+        char c = static_cast<char>(value & 0x7F);
+        value >>= 7;
+        if (value)
+        {
+            c |= 0x80;
+        }
+        bytes[size++] = c;
+    }
+    while (value);
+    put(bytes, size);
+}
+
+frame_reader::frame_reader(encoding enc, const char *data, size_t size) :
+    enc{enc}, pos{data}, end{data + size}
+{
+}
+
+opcode frame_reader::read_command()
+{
+    if (enc == encoding::TEXT)
+    {
+        const auto &codes = opcodes().codes;
+        auto it = codes.find(read_string());
+        if (it == codes.end())
+        {
+            throw invalid_token_exception{};
+        }
+        return it->second;
+    }
+
+    if (pos == end)
+    {
+        throw invalid_token_exception{};
+    }
+    auto op = static_cast<size_t>(static_cast<unsigned char>(*pos++));
+    if (op >= OPCODES_COUNT || opcodes().names[op].empty())
+    {
+        throw invalid_token_exception{};
+    }
+    return static_cast<opcode>(op);
+}
+
+result_code frame_reader::read_result()
+{
+    if (enc == encoding::TEXT)
+    {
+        const auto &codes = results().codes;
+        auto it = codes.find(read_string());
+        if (it == codes.end())
+        {
+            throw invalid_token_exception{};
+        }
+        return it->second;
+    }
+
+    uint64_t code = read_varint();
+    if (code >= RESULT_CODES_COUNT)
+    {
+        throw invalid_token_exception{};
+    }
+    return static_cast<result_code>(code);
+}
+
+string frame_reader::read_string()
+{
+    if (enc == encoding::TEXT)
+    {
+        const char *token_end;
+        const char *token = next_token(token_end);
+        return string{token, token_end};
+    }
+
+    uint64_t size = read_varint();
+    if (size > static_cast<uint64_t>(end - pos))
+    {
+        throw invalid_token_exception{};
+    }
+    string s{pos, static_cast<size_t>(size)};
+    pos += size;
+    return s;
+}
+
+uint64_t frame_reader::read_uint()
+{
+    if (enc == encoding::BINARY)
+    {
+        return read_varint();
+    }
+
+    const char *token_end;
+    const char *token = next_token(token_end);
+    if (token == token_end)
+    {
+        throw invalid_token_exception{};
+    }
+
+    uint64_t value = 0;
+    for (const char *p = token; p != token_end; ++p)
+    {
+        if (*p < '0' || *p > '9')
+        {
+            throw invalid_token_exception{};
+        }
+        uint64_t digit = static_cast<uint64_t>(*p - '0');
+        if (value > (numeric_limits<uint64_t>::max() - digit) / 10)
+        {
+            throw invalid_token_exception{};
+        }
+        value = value * 10 + digit;
+    }
+    return value;
+}
+
+bool frame_reader::is_empty() const
+{
+    return pos == end;
+}
+
+const char *frame_reader::next_token(const char *&token_end)
+{
+    if (pos == end)
+    {
+        throw invalid_token_exception{};
+    }
+
+    const char *token = pos;
+    token_end = find_byte(pos, end, text().separator);
+    pos = token_end == end ? end : token_end + 1;
+    return token;
+}
+
+uint64_t frame_reader::read_varint()
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < MAX_VARINT_SIZE; ++i)
+    {
+        if (pos == end)
+        {
+            throw invalid_token_exception{};
+        }
+        auto c = static_cast<unsigned char>(*pos++);
+        value |= static_cast<uint64_t>(c & 0x7F) << (7 * i);
+        if (!(c & 0x80))
+        {
+            return value;
+        }
+    }
+    throw invalid_token_exception{};
+}
+
+void frame_decoder::reset(encoding new_enc)
+{
+    data_begin = 0;
+    data_end = 0;
+    scanned = 0;
+    required = 0;
+    enc = new_enc;
+}
+
+void frame_decoder::release()
+{
+    if (empty())
+    {
+        reset(enc);
+        buf.release();
+    }
+}
+
+void frame_decoder::prepare()
+{
+    if (data_begin != 0)
+    {
+        size_t size = data_end - data_begin;
+        memmove(buf.data(), buf.data() + data_begin, size);
+        scanned -= data_begin;
+        data_begin = 0;
+        data_end = size;
+    }
+
+    buf.reserve(max(data_end + MIN_BUFFER_SIZE, required), data_end);
+}
+
+frame_decoder::status frame_decoder::next(const char *&frame,
+                                          size_t &frame_size)
+{
+    const char *data = buf.data();
+    if (enc == encoding::TEXT)
+    {
+        const char *terminator = find_byte(data + scanned, data + data_end,
+                                           text().terminator);
+        if (terminator == data + data_end)
+        {
+            scanned = data_end;
+            return data_end - data_begin >= MAX_TEXT_FRAME_SIZE ?
+                        status::INVALID : status::NEED_MORE;
+        }
+
+        frame = data + data_begin;
+        frame_size = static_cast<size_t>(terminator - frame);
+        data_begin = static_cast<size_t>(terminator - data) + 1;
+        scanned = data_begin;
+        return status::FRAME;
+    }
+
+    size_t available = data_end - data_begin;
+    if (available < BINARY_HEADER_SIZE)
+    {
+        return status::NEED_MORE;
+    }
+    size_t size = read_frame_size(data + data_begin);
+    if (size == 0 || BINARY_HEADER_SIZE + size > MAX_BINARY_FRAME_SIZE)
+    {
+        return status::INVALID;
+    }
+    if (available < BINARY_HEADER_SIZE + size)
+    {
+        required = BINARY_HEADER_SIZE + size;
+        return status::NEED_MORE;
+    }
+
+    frame = data + data_begin + BINARY_HEADER_SIZE;
+    frame_size = size;
+    required = 0;
+    data_begin += BINARY_HEADER_SIZE + size;
+    scanned = data_begin;
+    return status::FRAME;
+}
+
+size_t frame_decoder::read_raw(char *dst, size_t size)
+{
+    size_t n = min(size, data_end - data_begin);
+    memcpy(dst, buf.data() + data_begin, n);
+    data_begin += n;
+    scanned = max(scanned, data_begin);
+    return n;
+}
+
+}//p2p
@@ -0,0 +1,152 @@
+#ifndef P2P_CODEC_H
+#define P2P_CODEC_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include <p2p_common.h>
+#include "p2p_buffer_pool.h"
+
+namespace p2p {
+
+enum class encoding { TEXT, BINARY };
+
+const std::string BINARY_ENCODING = "BINARY";
+
+enum class opcode : uint8_t
+{
+    GET_VERSION = 1,
+    REGISTER,
+    UNREGISTER,
+    AUTORIZE,
+    GET_CONTACTS,
+    SEND_MESSAGE,
+    SYNC_CONTACTS,
+    PING,
+    RESUME,
+    CONNECT_TO_CLIENT,
+    CONFIRM_CONNECTION,
+    DISCARD_CONNECTION,
+    CLOSE_CLIENT_CONNECTION,
+    CONFIRM_READING,
+
+    FRIEND_STATUS_UPDATED = 32,
+    FRIEND_WANTED_TO_CONNECT,
+    FRIEND_WANTED_TO_STOP_CONNECTION,
+    FRIEND_CONFIRMED_CONNECTION,
+    FRIEND_DISCARDED_CONNECTION,
+    FRIEND_CONNECTED,
+    FRIEND_WANTED_TO_DISCONNECT,
+    FRIEND_DISCONNECTED,
+    FRIEND_NEW_MESSAGE,
+    FRIEND_MESSAGE_DELIVERED,
+    FRIEND_MESSAGE_READED,
+
+    PEER_HELLO = 64,
+    PEER_MESSAGE,
+    PEER_DELIVERED,
+    PEER_READED,
+    PEER_BYE,
+    PEER_PING,
+    PEER_PONG,
+    PEER_DATA,
+    PEER_ACK,
+    PEER_DELIVERED_UP_TO,
+    PEER_READED_UP_TO,
+};
+constexpr size_t OPCODES_COUNT =
+        static_cast<size_t>(opcode::PEER_READED_UP_TO) + 1;
+
+enum class result_code : uint8_t
+{
+    OK,
+    NEED_CODE,
+    INVALID_CODE,
+    ALREADY_EXISTS,
+    INVALID_ACTION,
+    INVALID_PHONE,
+    INVALID_PASSWORD,
+};
+constexpr size_t RESULT_CODES_COUNT =
+        static_cast<size_t>(result_code::INVALID_PASSWORD) + 1;
+
+const std::string &to_string(opcode op);
+const std::string &to_string(result_code code);
+
+constexpr size_t BINARY_HEADER_SIZE = 4;
+constexpr size_t MAX_BINARY_FRAME_SIZE = 1024 * 1024;
+
+class frame_writer
+{
+public:
+    frame_writer(encoding enc, pooled_buffer &buf, size_t &buf_size);
+
+    void write_command(opcode op);
+    void append_param(const std::string &param);
+    void append_uint(uint64_t value);
+    void finalize();
+
+private:
+    const encoding enc;
+    pooled_buffer &buf;
+    size_t &buf_size;
+    const size_t frame_start;
+    buffer_type *text_buf = nullptr;
+    size_t text_size = 0;
+
+    void put(const char *data, size_t size);
+    void put_varint(uint64_t value);
+};
+
+class frame_reader
+{
+public:
+    frame_reader(encoding enc, const char *data, size_t size);
+
+    opcode read_command();
+    result_code read_result();
+    std::string read_string();
+    uint64_t read_uint();
+    bool is_empty() const;
+
+private:
+    const encoding enc;
+    const char *pos;
+    const char *end;
+
+    const char *next_token(const char *&token_end);
+    uint64_t read_varint();
+};
+
+class frame_decoder
+{
+public:
+    void reset(encoding new_enc);
+    void set_encoding(encoding new_enc) { enc = new_enc; }
+
+    bool empty() const { return data_begin == data_end; }
+    void release();
+
+    void prepare();
+    char *free_space() { return buf.data() + data_end; }
+    size_t free_size() const { return buf.capacity() - data_end; }
+    void commit(size_t bytes) { data_end += bytes; }
+
+    enum class status { FRAME, NEED_MORE, INVALID };
+    status next(const char *&frame, size_t &frame_size);
+
+    size_t read_raw(char *dst, size_t size);
+
+private:
+    pooled_buffer buf;
+    size_t data_begin = 0;
+    size_t data_end = 0;
+    size_t scanned = 0;
+    size_t required = 0;
+    encoding enc = encoding::TEXT;
+};
+
+}//p2p
+
+#endif // P2P_CODEC_H
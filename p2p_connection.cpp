@@ -4,12 +4,19 @@
 #include <cstdint>
 #include <memory>
 #include <atomic>
-#include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <vector>
+#include <array>
+#include <functional>
+#include <random>
+#include <algorithm>
 #include <boost/asio.hpp>
 #include "p2p_common.h"
 #include "p2p_requests.h"
+#include "p2p_events.h"
+#include "p2p_notifications.h"
+#include "p2p_codec.h"
 
 #include <iostream>
 
@@ -21,186 +28,872 @@ using boost_error = boost::system::error_code;
 namespace p2p
 {
 
-const auto ANSWER_TIMEOUT = boost::posix_time::seconds(5);
+constexpr std::chrono::milliseconds INITIAL_ANSWER_TIMEOUT{5000};
+constexpr std::chrono::milliseconds MIN_ANSWER_TIMEOUT{200};
+constexpr std::chrono::milliseconds MAX_ANSWER_TIMEOUT{60000};
+constexpr std::chrono::milliseconds TIMER_RESOLUTION{50};
+constexpr size_t MAX_MESSAGE_SIZE = 16 * 1024 * 1024;
+constexpr size_t MAX_BATCH_FRAMES = 64;
+constexpr size_t MAX_BATCH_BYTES = 64 * 1024;
 
-connection::connection() : server_socket{service}, answer_timer{service}
+connection::connection(io_service &service, bool caller_driven) :
+    service(service), caller_driven{caller_driven}, strand{service},
+    server_socket{service}, reconnect_timer{service},
+    reconnect_random{random_device{}()}, wheel_timer{service}
 {
+    answer_timeouts.fill(std::chrono::milliseconds::zero());
 }
 
-connection::~connection()
+connection::ptr connection::create(io_service &service, bool caller_driven)
 {
-    stop();
+    connection *c = new connection{service, caller_driven};
+    return ptr{c};
 }
 
-connection::ptr connection::create()
+template <typename Predicate>
+void connection::wait(unique_lock<mutex> &lck, condition_variable &cond_var,
+                      Predicate pred)
 {
-    connection *c = new connection{};
-    return ptr{c};
+    if (!caller_driven)
+    {
+        cond_var.wait(lck, pred);
+        return;
+    }
+
+    while (!pred())
+    {
+        lck.unlock();
+        service.run_one();
+        lck.lock();
+    }
 }
 
-void connection::connect(std::string address, uint16_t port)
+void connection::connect(std::string address, uint16_t port,
+                         connect_handler handler)
 {
-    if (trying_to_connect || server_socket.is_open())
     {
+        unique_lock<mutex> lck(connection_mutex);
+        if (!trying_to_connect && !connected)
+        {
+            server_endpoint =
+                    tcp::endpoint{ip::address::from_string(address), port};
+            on_connect = move(handler);
+            trying_to_connect = true;
+            handler = nullptr;
+        }
+    }
+
+    if (handler)
+    {
+        handler(connected);
         return;
     }
 
-    server_endpoint = tcp::endpoint{ip::address::from_string(address), port};
-    trying_to_connect = true;
-    start();
+    strand.post([self = shared_from_this()]
+                { self->stop_reconnect();
+                  self->start_connect(); });
 }
 
 void connection::wait_connection()
 {
     unique_lock<mutex> lck(connection_mutex);
-    connection_cond_var.wait(lck, [this]{ return !trying_to_connect; });
+    wait(lck, connection_cond_var, [this]{ return !trying_to_connect; });
 }
 
-bool connection::answer_is_ready()
+bool connection::answer_is_ready(request_id_type id)
 {
-    if (answer_exception)
+    lock_guard<mutex> lck(answer_mutex);
+    auto it = requests.find(id);
+    if (it == requests.end() || it->second.state == answer_state::FAILED)
     {
         throw communication_exception{};
     }
-    if (!is_connected())
+    if (it->second.state == answer_state::DISCONNECTED)
     {
         throw disconnected_exception{};
     }
-    return has_answer;
+    return it->second.state == answer_state::READY;
 }
 
-void connection::wait_answer()
+void connection::wait_answer(request_id_type id)
 {
     unique_lock<mutex> lck(answer_mutex);
-    answer_cond_var.wait(lck, [this]{ return has_answer; });
-    if (answer_exception)
+    auto it = requests.find(id);
+    if (it == requests.end())
     {
         throw communication_exception{};
     }
-    if (!is_connected())
+    wait(lck, answer_cond_var, [it]
+         { return it->second.state != answer_state::WAITING; });
+
+    answer_state state = it->second.state;
+    requests.erase(it);
+    if (state == answer_state::FAILED)
+    {
+        throw communication_exception{};
+    }
+    if (state == answer_state::DISCONNECTED)
     {
         throw disconnected_exception{};
     }
 }
 
-void connection::send_request(std::unique_ptr<request> &&r)
+request_id_type connection::send_request(std::unique_ptr<request> &&r)
 {
-    current_request = move(r);
-    start_write();
+    return add_request(move(r), nullptr);
 }
 
-void connection::start()
+void connection::send_request(std::unique_ptr<request> &&r,
+                              answer_handler handler)
 {
-    service_thread = thread{[this]{service_thread_handler();}};
+    add_request(move(r), move(handler));
 }
 
-void connection::stop()
+request_id_type connection::add_request(std::unique_ptr<request> &&r,
+                                        answer_handler handler)
 {
-    work.reset();
-    if (service_thread.joinable())
+    request_id_type id;
+    {
+        lock_guard<mutex> lck(answer_mutex);
+        if (++last_request_id == 0)
+        {
+            ++last_request_id;
+        }
+        id = last_request_id;
+        r->set_id(id);
+        if (!is_connected())
+        {
+            if (!handler)
+            {
+                requests[id].state = answer_state::DISCONNECTED;
+            }
+        }
+        else
+        {
+            pending_request &p = requests[id];
+            p.req = move(r);
+            p.handler = move(handler);
+            handler = nullptr;
+        }
+    }
+
+    if (handler)
     {
-        service_thread.join();
+        handler(answer_state::DISCONNECTED);
+        return id;
     }
+
+    if (strand.running_in_this_thread() && handshaking)
+    {
+        write_queue.push_back(id);
+        if (!writing)
+        {
+            start_write();
+        }
+        return id;
+    }
+
+    strand.post([self = shared_from_this(), id]
+                 { self->write_queue.push_back(id);
+                   if (!self->writing) self->start_write(); });
+    return id;
 }
 
-void connection::service_thread_handler()
+void connection::post_request(std::unique_ptr<request> &&r)
 {
-    server_socket.async_connect(server_endpoint,
-        [this](boost_error ec)
+    add_request(move(r), [](answer_state){});
+}
+
+void connection::complete_request(request_id_type id, answer_state state)
+{
+    answer_handler handler;
+    {
+        lock_guard<mutex> lck(answer_mutex);
+        auto it = requests.find(id);
+        if (it == requests.end() || it->second.state != answer_state::WAITING)
+        {
+            return;
+        }
+
+        if (it->second.handler)
+        {
+            handler = move(it->second.handler);
+            requests.erase(it);
+        }
+        else
+        {
+            it->second.state = state;
+            answer_cond_var.notify_all();
+        }
+    }
+
+    if (handler)
+    {
+        handler(state);
+    }
+}
+
+void connection::complete_all_requests(answer_state state)
+{
+    vector<answer_handler> handlers;
+    {
+        lock_guard<mutex> lck(answer_mutex);
+        for (auto it = requests.begin(); it != requests.end();)
         {
+            if (it->second.state != answer_state::WAITING)
+            {
+                ++it;
+            }
+            else if (it->second.handler)
+            {
+                handlers.push_back(move(it->second.handler));
+                it = requests.erase(it);
+            }
+            else
+            {
+                it->second.state = state;
+                ++it;
+            }
+        }
+        answer_cond_var.notify_all();
+    }
+
+    for (auto &handler : handlers)
+    {
+        handler(state);
+    }
+}
+
+void connection::start_connect()
+{
+    boost_error ec;
+    server_socket.close(ec);
+    wire_encoding = encoding::TEXT;
+    write_barrier = 0;
+    decoder.reset(wire_encoding);
+    reading_message = false;
+    unsigned attempt = ++connect_attempt;
+    server_socket.async_connect(server_endpoint, strand.wrap(
+        [self = shared_from_this(), attempt](boost_error ec)
+        {
+            if (attempt != self->connect_attempt)
+            {
+                return;
+            }
+
             if (!ec)
             {
-                work = make_unique<io_service::work>(service);
+                boost_error nb_ec;
+                self->server_socket.non_blocking(true, nb_ec);
+                auto local = self->server_socket.local_endpoint(nb_ec);
+                {
+                    lock_guard<mutex> lck(self->connection_mutex);
+                    self->local_address_value = local.address().to_string();
+                }
+                self->connected = true;
+                self->last_receive = std::chrono::steady_clock::now();
+                if (self->reconnecting.exchange(false))
+                {
+                    self->handshaking = true;
+                    if (self->on_reconnect)
+                    {
+                        self->on_reconnect();
+                    }
+                    else
+                    {
+                        self->reconnected();
+                    }
+                    self->handshaking = false;
+                }
+                else
+                {
+                    self->reconnect_failures = 0;
+                }
+                self->start_keepalive(self->keepalive_interval);
+                self->start_read();
+            }
+            else if (self->reconnecting)
+            {
+                self->schedule_reconnect();
+                return;
+            }
+
+            {
+                unique_lock<mutex> lck(self->connection_mutex);
+                self->trying_to_connect = false;
+                self->connection_cond_var.notify_all();
+            }
 
-                unique_lock<mutex> lck(connection_mutex);
-                trying_to_connect = false;
-                connection_cond_var.notify_all();
+            if (self->on_connect)
+            {
+                auto handler = move(self->on_connect);
+                self->on_connect = nullptr;
+                handler(!ec);
             }
         }
-    );
+    ));
+}
+
+void connection::close_connection()
+{
+    strand.dispatch([self = shared_from_this()]
+                    { self->close_connection(boost_error{}, false); });
+}
+
+void connection::set_reconnect(bool enabled,
+                               std::chrono::milliseconds min_delay,
+                               std::chrono::milliseconds max_delay)
+{
+    strand.dispatch([self = shared_from_this(), enabled, min_delay, max_delay]
+    {
+        self->reconnect_enabled = enabled;
+        self->reconnect_min_delay = max(min_delay, TIMER_RESOLUTION);
+        self->reconnect_max_delay = max(max_delay, self->reconnect_min_delay);
+        if (!enabled && self->reconnecting)
+        {
+            self->close_connection(boost_error{}, false);
+        }
+    });
+}
+
+void connection::set_reconnect_handler(reconnect_handler handler)
+{
+    on_reconnect = move(handler);
+}
+
+void connection::reconnected()
+{
+    strand.dispatch([self = shared_from_this()]
+    {
+        self->reconnect_failures = 0;
+        if (self->connected && self->on_event)
+        {
+            self->on_event(make_event<reconnected_event>());
+        }
+    });
+}
+
+void connection::schedule_reconnect()
+{
+    auto delay = reconnect_min_delay;
+    for (unsigned i = 0; i < reconnect_failures && delay < reconnect_max_delay;
+         ++i)
+    {
+        delay *= 2;
+    }
+    delay = min(delay, reconnect_max_delay);
+    ++reconnect_failures;
+
+    uniform_int_distribution<int64_t> jitter{0, delay.count()};
+    reconnect_timer.expires_from_now(
+                boost::posix_time::milliseconds(jitter(reconnect_random)));
+    reconnect_timer.async_wait(strand.wrap(
+        [self = shared_from_this()](boost_error ec)
+        {
+            if (ec != error::operation_aborted && self->reconnecting)
+            {
+                self->start_connect();
+            }
+        }));
+}
+
+void connection::stop_reconnect()
+{
+    boost_error ec;
+    reconnecting = false;
+    reconnect_timer.cancel(ec);
+}
+
+void connection::set_event_handler(event_handler handler)
+{
+    on_event = move(handler);
+}
+
+void connection::set_endpoint_handler(endpoint_handler handler)
+{
+    on_endpoint = move(handler);
+}
 
-    service.run();
+string connection::local_address()
+{
+    lock_guard<mutex> lck(connection_mutex);
+    return local_address_value;
 }
 
-void connection::close_connection(boost_error error)
+void connection::close_connection(boost_error error, bool reconnect)
 {
-    if (error.value() != 0)
+    bool was_connected = connected.exchange(false);
+    bool was_reconnecting = reconnecting.exchange(false);
+    if (was_connected && error && error != error::operation_aborted)
     {
         cout << "error = " << error.value() << endl;
     }
-    server_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
-    server_socket.close();
-    unique_lock<mutex> lck(answer_mutex);
-    has_answer = true;
-    answer_cond_var.notify_all();
-    stop();
-    service.reset();
+    boost_error ec;
+    server_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+    server_socket.close(ec);
+    wheel_timer.cancel(ec);
+    wheel_timer_armed = false;
+    timers.clear();
+    keepalive_timer = 0;
+    write_queue.clear();
+    writing = false;
+    write_barrier = 0;
+    decoder.reset(wire_encoding);
+    decoder.release();
+    reconnect_timer.cancel(ec);
+
+    bool was_active = was_connected || was_reconnecting;
+    reconnecting = was_active && reconnect && reconnect_enabled;
+    complete_all_requests(answer_state::DISCONNECTED);
+
+    if (reconnecting)
+    {
+        schedule_reconnect();
+    }
+    else if (was_active && on_event)
+    {
+        on_event(make_event<disconnected_event>());
+    }
+}
+
+void connection::set_answer_timeout(opcode command,
+                                    std::chrono::milliseconds timeout)
+{
+    strand.dispatch([self = shared_from_this(), command, timeout]
+                    { self->answer_timeouts[static_cast<size_t>(command)] =
+                            timeout; });
+}
+
+void connection::set_keepalive(std::chrono::milliseconds interval,
+                               std::chrono::milliseconds timeout)
+{
+    strand.dispatch([self = shared_from_this(), interval, timeout]
+    {
+        self->keepalive_interval = interval;
+        self->answer_timeouts[static_cast<size_t>(opcode::PING)] = timeout;
+        self->timers.cancel(self->keepalive_timer);
+        self->keepalive_timer = 0;
+        self->start_keepalive(interval);
+    });
+}
+
+void connection::start_answer_timer(request_id_type id, opcode command)
+{
+    advance_timers();
+    {
+        lock_guard<mutex> lck(answer_mutex);
+        auto it = requests.find(id);
+        if (it == requests.end() || it->second.state != answer_state::WAITING)
+        {
+            return;
+        }
+
+        std::chrono::microseconds timeout =
+                answer_timeouts[static_cast<size_t>(command)];
+        if (timeout == std::chrono::microseconds::zero())
+        {
+            timeout = answers_rtt.rto(TIMER_RESOLUTION, MIN_ANSWER_TIMEOUT,
+                                      MAX_ANSWER_TIMEOUT,
+                                      INITIAL_ANSWER_TIMEOUT);
+        }
+        it->second.sent = std::chrono::steady_clock::now();
+        it->second.timer = timers.add(timer_ticks(timeout), [this]
+                                      { close_connection(boost_error{}); });
+    }
+    schedule_timers();
+}
+
+void connection::start_keepalive(std::chrono::microseconds delay)
+{
+    if (!connected || keepalive_interval == std::chrono::milliseconds::zero())
+    {
+        return;
+    }
+
+    advance_timers();
+    keepalive_timer = timers.add(timer_ticks(delay), [this]{ keepalive(); });
+    schedule_timers();
+}
+
+void connection::keepalive()
+{
+    keepalive_timer = 0;
+    auto idle = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - last_receive);
+    if (idle < keepalive_interval)
+    {
+        start_keepalive(keepalive_interval - idle);
+        return;
+    }
+
+    if (!ping_in_flight && timers.empty())
+    {
+        ping_in_flight = true;
+        add_request(make_unique<ping_request>(),
+                    [self = shared_from_this()](answer_state)
+                    { self->ping_in_flight = false; });
+    }
+    start_keepalive(keepalive_interval);
+}
+
+uint64_t connection::timer_ticks(std::chrono::microseconds timeout)
+{
+    return static_cast<uint64_t>(
+                (timeout + TIMER_RESOLUTION - std::chrono::microseconds{1}) /
+                TIMER_RESOLUTION + 1);
+}
+
+void connection::advance_timers()
+{
+    if (advancing_timers)
+    {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (timers.empty())
+    {
+        last_tick = now;
+        return;
+    }
+
+    auto ticks = (now - last_tick) / TIMER_RESOLUTION;
+    last_tick += ticks * TIMER_RESOLUTION;
+    advancing_timers = true;
+    timers.advance(static_cast<uint64_t>(ticks));
+    advancing_timers = false;
+}
+
+void connection::schedule_timers()
+{
+    if (timers.empty())
+    {
+        return;
+    }
+
+    auto wake = last_tick + timers.ticks_to_next_event() * TIMER_RESOLUTION;
+    if (wheel_timer_armed && wake >= wheel_wake)
+    {
+        return;
+    }
+
+    wheel_timer_armed = true;
+    wheel_wake = wake;
+    auto delay = std::chrono::duration_cast<std::chrono::microseconds>(
+                wake - std::chrono::steady_clock::now());
+    wheel_timer.expires_from_now(boost::posix_time::microseconds(
+                                     max<int64_t>(delay.count(), 0)));
+    wheel_timer.async_wait(strand.wrap(
+        [self = shared_from_this()](boost_error ec)
+        { if (ec == error::operation_aborted) return;
+          self->wheel_timer_armed = false;
+          self->advance_timers();
+          self->schedule_timers(); }));
 }
 
 void connection::start_write()
 {
-    has_answer = false;
-    answer_exception = false;
-    current_request->fill_request(buf, buf_size);
-    async_write(server_socket, buffer(buf, buf_size),
+    write_batch.clear();
+    write_segments.clear();
+    write_buf_size = 0;
+    size_t payloads_size = 0;
+    size_t headers_begin = 0;
+    while (!write_barrier && !write_queue.empty() &&
+           write_batch.size() < MAX_BATCH_FRAMES &&
+           write_buf_size + payloads_size < MAX_BATCH_BYTES)
+    {
+        request_id_type id = write_queue.front();
+        write_queue.pop_front();
+
+        request *r = nullptr;
+        {
+            lock_guard<mutex> lck(answer_mutex);
+            auto it = requests.find(id);
+            if (it != requests.end() &&
+                it->second.state == answer_state::WAITING)
+            {
+                r = it->second.req.get();
+            }
+        }
+        if (!r)
+        {
+            continue;
+        }
+
+        frame_writer writer{wire_encoding, write_buf, write_buf_size};
+        r->fill_request(writer);
+        if (r->negotiates_encoding())
+        {
+            write_barrier = id;
+        }
+        write_batch.push_back({id, r->command(), r->expects_answer()});
+
+        const_buffer payload = r->payload();
+        if (buffer_size(payload) != 0)
+        {
+            write_segments.push_back({headers_begin, write_buf_size, payload});
+            headers_begin = write_buf_size;
+            payloads_size += buffer_size(payload);
+        }
+    }
+    if (headers_begin != write_buf_size)
+    {
+        write_segments.push_back({headers_begin, write_buf_size, {}});
+    }
+
+    writing = !write_batch.empty();
+    if (!writing)
+    {
+        write_buf.release();
+        return;
+    }
+
+    vector<const_buffer> buffers;
+    buffers.reserve(2 * write_segments.size());
+    for (const write_segment &s : write_segments)
+    {
+        buffers.push_back(buffer(write_buf.data() + s.begin, s.end - s.begin));
+        if (buffer_size(s.payload) != 0)
+        {
+            buffers.push_back(s.payload);
+        }
+    }
+
+    async_write(server_socket, buffers, strand.wrap(
                 [self = shared_from_this()](boost_error ec, size_t)
-                { if (ec) self->close_connection(ec);
-                  else self->start_read(); });
+                { self->write_complete(ec); }));
 }
 
-void connection::start_read()
+void connection::write_complete(boost_error ec)
 {
-    async_read(server_socket, buffer(buf),
-               [self = shared_from_this()](boost_error error, size_t bytes)
-               { return self->read_complete(error, bytes); },
-               [self = shared_from_this()](boost_error error, size_t bytes)
-               { self->read(error, bytes); });
+    if (ec == error::operation_aborted)
+    {
+        return;
+    }
+    if (ec)
+    {
+        write_buf.release();
+        close_connection(ec);
+        return;
+    }
 
-    answer_timer.expires_from_now(ANSWER_TIMEOUT);
-    answer_timer.async_wait([self = shared_from_this()](boost_error ec)
-                            { if (ec != error::operation_aborted)
-                              self->close_connection(ec); });
+    for (const write_item &item : write_batch)
+    {
+        if (item.expects_answer)
+        {
+            start_answer_timer(item.id, item.command);
+        }
+        else
+        {
+            complete_request(item.id, answer_state::READY);
+        }
+    }
+    start_write();
+}
+
+void connection::start_read()
+{
+    decoder.release();
+    server_socket.async_wait(tcp::socket::wait_read, strand.wrap(
+                [self = shared_from_this()](boost_error error)
+                { self->read(error); }));
 }
 
-size_t connection::read_complete(boost::system::error_code error, size_t bytes)
+void connection::read(boost::system::error_code error)
 {
+    if (error == error::operation_aborted)
+    {
+        return;
+    }
     if (error)
     {
         close_connection(error);
-        return 0;
+        return;
     }
 
-    return p2p::read_complete(buf, bytes);
-}
-
-void connection::read(boost::system::error_code error, size_t bytes)
-{
-    answer_timer.cancel();
+    decoder.prepare();
+    size_t bytes = server_socket.read_some(
+                buffer(decoder.free_space(), decoder.free_size()), error);
+    if (error == error::would_block)
+    {
+        start_read();
+        return;
+    }
     if (error)
     {
         close_connection(error);
         return;
     }
 
-    if (p2p::is_valid_message(buf, bytes))
+    last_receive = std::chrono::steady_clock::now();
+    decoder.commit(bytes);
+    read_frames();
+}
+
+void connection::read_frames()
+{
+    while (connected && !reading_message)
     {
-        if (current_request->process_answer(buf, bytes))
+        const char *frame;
+        size_t frame_size;
+        frame_decoder::status status = decoder.next(frame, frame_size);
+        if (status == frame_decoder::status::NEED_MORE)
         {
-            unique_lock<mutex> lck(answer_mutex);
-            has_answer = true;
-            answer_cond_var.notify_all();
+            start_read();
+            return;
         }
-        else
+
+        if (status == frame_decoder::status::INVALID ||
+            !read_frame(frame, frame_size))
+        {
+            complete_all_requests(answer_state::FAILED);
+            close_connection(boost_error{});
+            return;
+        }
+    }
+}
+
+bool connection::read_frame(const char *frame, size_t frame_size)
+{
+    request_id_type id;
+    frame_reader header{wire_encoding, frame, frame_size};
+    if (!read_answer_id(header, id))
+    {
+        return false;
+    }
+
+    if (id == 0)
+    {
+        return read_notification(frame, frame_size);
+    }
+
+    request *r = nullptr;
+    timer_wheel::timer_id timer = 0;
+    std::chrono::steady_clock::time_point sent;
+    {
+        lock_guard<mutex> lck(answer_mutex);
+        auto it = requests.find(id);
+        if (it != requests.end() && it->second.state == answer_state::WAITING)
+        {
+            r = it->second.req.get();
+            timer = it->second.timer;
+            sent = it->second.sent;
+        }
+    }
+
+    frame_reader reader{wire_encoding, frame, frame_size};
+    if (!r || !r->process_answer(reader))
+    {
+        return false;
+    }
+    bool release_writes = id == write_barrier;
+    if (release_writes)
+    {
+        wire_encoding = r->answer_encoding(wire_encoding);
+        decoder.set_encoding(wire_encoding);
+        write_barrier = 0;
+    }
+    if (timers.cancel(timer))
+    {
+        answers_rtt.add_sample(
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - sent));
+    }
+    complete_request(id, answer_state::READY);
+
+    if (release_writes && !writing)
+    {
+        start_write();
+    }
+    return true;
+}
+
+bool connection::read_notification(const char *frame, size_t frame_size)
+{
+    friend_id_type friend_id;
+    message_id_type message_id;
+    size_t message_size;
+    frame_reader header{wire_encoding, frame, frame_size};
+    if (read_new_message_header(header, friend_id, message_id, message_size))
+    {
+        if (message_size > MAX_MESSAGE_SIZE)
         {
-            answer_exception = true;
-            close_connection();
+            return false;
         }
+        read_message(friend_id, message_id, message_size);
+        return true;
     }
-    else
+
+    frame_reader confirmation{wire_encoding, frame, frame_size};
+    peer_endpoint endpoint;
+    if (read_confirmed_connection(confirmation, friend_id, endpoint))
     {
-        answer_exception = true;
-        close_connection();
+        if (on_endpoint)
+        {
+            on_endpoint(friend_id, endpoint);
+        }
+        if (on_event)
+        {
+            on_event(make_event<friend_confirmed_connection_event>(friend_id));
+        }
+        return true;
+    }
+
+    frame_reader reader{wire_encoding, frame, frame_size};
+    event::ptr e = p2p::read_notification(reader);
+    if (!e)
+    {
+        return false;
+    }
+
+    if (on_event)
+    {
+        on_event(move(e));
+    }
+    return true;
+}
+
+void connection::read_message(friend_id_type friend_id,
+                              message_id_type message_id, size_t message_size)
+{
+    auto message = make_shared<string>(message_size, '\0');
+    size_t buffered = decoder.read_raw(&(*message)[0], message_size);
+    if (buffered == message_size)
+    {
+        if (on_event)
+        {
+            on_event(make_event<friend_new_message_event>(friend_id, message,
+                                                          message_id));
+        }
+        return;
     }
+
+    reading_message = true;
+    async_read(server_socket,
+               buffer(&(*message)[buffered], message_size - buffered),
+               strand.wrap(
+               [self = shared_from_this(), friend_id, message_id, message]
+               (boost_error error, size_t)
+               {
+                   if (error == error::operation_aborted)
+                   {
+                       return;
+                   }
+                   self->reading_message = false;
+                   if (error)
+                   {
+                       self->close_connection(error);
+                       return;
+                   }
+                   self->last_receive = std::chrono::steady_clock::now();
+
+                   if (self->on_event)
+                   {
+                       self->on_event(make_event<friend_new_message_event>(
+                                          friend_id, message, message_id));
+                   }
+                   self->read_frames();
+               }));
 }
 
 }
@@ -5,68 +5,183 @@
 #include <cstdint>
 #include <memory>
 #include <atomic>
-#include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <map>
+#include <deque>
+#include <vector>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <random>
 #include <boost/asio.hpp>
 #include "p2p_common.h"
 #include "p2p_requests.h"
+#include "p2p_events.h"
+#include "p2p_notifications.h"
+#include "p2p_codec.h"
+#include "p2p_buffer_pool.h"
+#include "p2p_timer_wheel.h"
+#include "p2p_rtt_estimator.h"
 
 namespace p2p
 {
 
 class connection : public std::enable_shared_from_this<connection>
 {
-    connection();
+    connection(boost::asio::io_service &service, bool caller_driven);
 
 public:
-    ~connection();
     using ptr = std::shared_ptr<connection>;
-    static ptr create();
+    static ptr create(boost::asio::io_service &service,
+                      bool caller_driven = false);
 
-    void connect(std::string address, uint16_t port);
+    using connect_handler = std::function<void(bool)>;
+    void connect(std::string address, uint16_t port,
+                 connect_handler handler = nullptr);
     void wait_connection();
-    bool is_connected() const { return server_socket.is_open(); }
+    bool is_connected() const { return connected; }
 
     struct disconnected_exception{};
     struct communication_exception{};
-    bool answer_is_ready();
-    void wait_answer();
+    bool answer_is_ready(request_id_type id);
+    void wait_answer(request_id_type id);
 
-    void send_request(std::unique_ptr<request> &&r);
+    request_id_type send_request(std::unique_ptr<request> &&r);
 
-    void close_connection(boost::system::error_code error =
-            boost::system::error_code{boost::system::errc::success,
-                                      boost::system::system_category()});
+    enum class answer_state { WAITING, READY, FAILED, DISCONNECTED };
+    using answer_handler = std::function<void(answer_state)>;
+    void send_request(std::unique_ptr<request> &&r, answer_handler handler);
+    void post_request(std::unique_ptr<request> &&r);
+
+    void close_connection();
+
+    void set_answer_timeout(opcode command, std::chrono::milliseconds timeout);
+    std::chrono::microseconds rtt() const { return answers_rtt.srtt(); }
+    void set_keepalive(std::chrono::milliseconds interval,
+                       std::chrono::milliseconds timeout);
+
+    using reconnect_handler = std::function<void()>;
+    void set_reconnect(bool enabled, std::chrono::milliseconds min_delay,
+                       std::chrono::milliseconds max_delay);
+    void set_reconnect_handler(reconnect_handler handler);
+    bool is_reconnecting() const { return reconnecting; }
+    void reconnected();
+
+    using event_handler = std::function<void(event::ptr)>;
+    void set_event_handler(event_handler handler);
+
+    using endpoint_handler =
+            std::function<void(friend_id_type, const peer_endpoint&)>;
+    void set_endpoint_handler(endpoint_handler handler);
+    std::string local_address();
 
 private:
-    boost::asio::io_service service;
-    std::unique_ptr<boost::asio::io_service::work> work;
+    boost::asio::io_service &service;
+    const bool caller_driven;
+    boost::asio::io_service::strand strand;
     boost::asio::ip::tcp::socket server_socket;
     boost::asio::ip::tcp::endpoint server_endpoint;
+    std::atomic<bool> connected{false};
 
     std::mutex connection_mutex;
     std::condition_variable connection_cond_var;
 
-    void start();
-    void stop();
-    void service_thread_handler();
-    std::thread service_thread;
+    template <typename Predicate>
+    void wait(std::unique_lock<std::mutex> &lck,
+              std::condition_variable &cond_var, Predicate pred);
+
+    void start_connect();
+    void close_connection(boost::system::error_code error,
+                          bool reconnect = true);
 
     bool trying_to_connect = false;
+    unsigned connect_attempt = 0;
+    connect_handler on_connect;
+    event_handler on_event;
+    endpoint_handler on_endpoint;
+    std::string local_address_value;
+
+    bool reconnect_enabled = false;
+    std::chrono::milliseconds reconnect_min_delay{0};
+    std::chrono::milliseconds reconnect_max_delay{0};
+    std::atomic<bool> reconnecting{false};
+    bool handshaking = false;
+    unsigned reconnect_failures = 0;
+    boost::asio::deadline_timer reconnect_timer;
+    std::minstd_rand reconnect_random;
+    reconnect_handler on_reconnect;
+    void schedule_reconnect();
+    void stop_reconnect();
 
-    std::unique_ptr<request> current_request;
-    buffer_type buf;
-    size_t buf_size;
+    struct pending_request
+    {
+        std::unique_ptr<request> req;
+        answer_state state = answer_state::WAITING;
+        answer_handler handler;
+        timer_wheel::timer_id timer = 0;
+        std::chrono::steady_clock::time_point sent;
+    };
+    request_id_type add_request(std::unique_ptr<request> &&r,
+                                answer_handler handler);
+    std::map<request_id_type, pending_request> requests;
+    request_id_type last_request_id = 0;
     std::mutex answer_mutex;
     std::condition_variable answer_cond_var;
-    bool has_answer = false;
-    bool answer_exception = false;
-    boost::asio::deadline_timer answer_timer;
+    void complete_request(request_id_type id, answer_state state);
+    void complete_all_requests(answer_state state);
+
+    encoding wire_encoding = encoding::TEXT;
+    request_id_type write_barrier = 0;
+    std::deque<request_id_type> write_queue;
+    bool writing = false;
+    pooled_buffer write_buf;
+    size_t write_buf_size = 0;
+    struct write_item
+    {
+        request_id_type id;
+        opcode command;
+        bool expects_answer;
+    };
+    std::vector<write_item> write_batch;
+    struct write_segment
+    {
+        size_t begin;
+        size_t end;
+        boost::asio::const_buffer payload;
+    };
+    std::vector<write_segment> write_segments;
+    frame_decoder decoder;
+    bool reading_message = false;
+    std::array<std::chrono::milliseconds, OPCODES_COUNT> answer_timeouts;
+    rtt_estimator answers_rtt;
+    timer_wheel timers;
+    boost::asio::deadline_timer wheel_timer;
+    bool wheel_timer_armed = false;
+    std::chrono::steady_clock::time_point last_tick;
+    std::chrono::steady_clock::time_point wheel_wake;
+    bool advancing_timers = false;
+    static uint64_t timer_ticks(std::chrono::microseconds timeout);
+    void advance_timers();
+    void schedule_timers();
+    void start_answer_timer(request_id_type id, opcode command);
+
+    std::chrono::milliseconds keepalive_interval{0};
+    timer_wheel::timer_id keepalive_timer = 0;
+    bool ping_in_flight = false;
+    std::chrono::steady_clock::time_point last_receive;
+    void start_keepalive(std::chrono::microseconds delay);
+    void keepalive();
+
     void start_write();
+    void write_complete(boost::system::error_code ec);
     void start_read();
-    size_t read_complete(boost::system::error_code error, size_t bytes);
-    void read(boost::system::error_code error, size_t bytes);
+    void read(boost::system::error_code error);
+    void read_frames();
+    bool read_frame(const char *frame, size_t frame_size);
+    bool read_notification(const char *frame, size_t frame_size);
+    void read_message(friend_id_type friend_id, message_id_type message_id,
+                      size_t message_size);
 };
 
 }
@@ -0,0 +1,221 @@
+#include "p2p_contacts_cache.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <fstream>
+#include <algorithm>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/exceptions.hpp>
+
+#include <p2p_common.h>
+
+using namespace std;
+namespace ipc = boost::interprocess;
+
+namespace p2p
+{
+
+namespace
+{
+
+constexpr uint32_t CACHE_MAGIC = 0x50325043;
+constexpr uint32_t CACHE_FORMAT = 1;
+
+}
+
+struct contacts_cache::mapping
+{
+    ipc::file_mapping file;
+    ipc::mapped_region region;
+};
+
+contacts_cache::contacts_cache(string path) : path{std::move(path)}
+{
+    map();
+}
+
+contacts_cache::~contacts_cache()
+{
+}
+
+uint64_t contacts_cache::version() const
+{
+    lock_guard<mutex> lck(cache_mutex);
+    return head ? head->version : 0;
+}
+
+uint64_t contacts_cache::hash() const
+{
+    lock_guard<mutex> lck(cache_mutex);
+    return head ? head->hash : 0;
+}
+
+size_t contacts_cache::size() const
+{
+    lock_guard<mutex> lck(cache_mutex);
+    return head ? static_cast<size_t>(head->count) : 0;
+}
+
+bool contacts_cache::find(const string &phone, friend_id_type &friend_id) const
+{
+    if (phone.size() >= PHONE_SIZE)
+    {
+        return false;
+    }
+
+    lock_guard<mutex> lck(cache_mutex);
+    if (!head)
+    {
+        return false;
+    }
+
+    const record *end = records + head->count;
+    const record *r = lower_bound(records, end, phone,
+        [](const record &r, const string &phone)
+        { return strncmp(r.phone, phone.c_str(), PHONE_SIZE) < 0; });
+    if (r == end || phone != r->phone)
+    {
+        return false;
+    }
+
+    friend_id = static_cast<friend_id_type>(r->friend_id);
+    return true;
+}
+
+contacts_cache::contacts_dictionary contacts_cache::contacts() const
+{
+    lock_guard<mutex> lck(cache_mutex);
+    contacts_dictionary result;
+    if (!head)
+    {
+        return result;
+    }
+
+    result.reserve(static_cast<size_t>(head->count));
+    for (const record *r = records; r != records + head->count; ++r)
+    {
+        result.emplace(r->phone, static_cast<friend_id_type>(r->friend_id));
+    }
+    return result;
+}
+
+bool contacts_cache::apply(const contacts_delta &delta)
+{
+    lock_guard<mutex> lck(cache_mutex);
+
+    std::map<string, uint64_t> merged;
+    if (head && !delta.reset)
+    {
+        for (const record *r = records; r != records + head->count; ++r)
+        {
+            merged.emplace(r->phone, r->friend_id);
+        }
+    }
+    for (const string &phone : delta.removed)
+    {
+        merged.erase(phone);
+    }
+    for (const auto &c : delta.changed)
+    {
+        if (c.first.size() < PHONE_SIZE)
+        {
+            merged[c.first] = static_cast<uint64_t>(c.second);
+        }
+    }
+
+    vector<record> new_records;
+    new_records.reserve(merged.size());
+    for (const auto &m : merged)
+    {
+        record r{};
+        memcpy(r.phone, m.first.c_str(), m.first.size());
+        r.friend_id = m.second;
+        new_records.push_back(r);
+    }
+
+    bool written = write(delta.version, new_records);
+    map();
+    return written;
+}
+
+void contacts_cache::map()
+{
+    unmap();
+
+    try
+    {
+        auto m = make_unique<mapping>();
+        m->file = ipc::file_mapping{path.c_str(), ipc::read_only};
+        m->region = ipc::mapped_region{m->file, ipc::read_only};
+        if (m->region.get_size() < sizeof(header))
+        {
+            return;
+        }
+
+        auto h = static_cast<const header*>(m->region.get_address());
+        if (h->magic != CACHE_MAGIC || h->format != CACHE_FORMAT ||
+            m->region.get_size() !=
+                sizeof(header) + h->count * sizeof(record))
+        {
+            return;
+        }
+
+        mapped = std::move(m);
+        head = h;
+        records = reinterpret_cast<const record*>(head + 1);
+    }
+    catch (ipc::interprocess_exception&)
+    {
+    }
+}
+
+void contacts_cache::unmap()
+{
+    head = nullptr;
+    records = nullptr;
+    mapped.reset();
+}
+
+bool contacts_cache::write(uint64_t version, const vector<record> &new_records)
+{
+    string tmp_path = path + ".tmp";
+    {
+        ofstream out{tmp_path, ios::binary | ios::trunc};
+        header h{CACHE_MAGIC, CACHE_FORMAT, version, get_hash(new_records),
+                 new_records.size()};
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char*>(new_records.data()),
+                  new_records.size() * sizeof(record));
+        if (!out)
+        {
+            return false;
+        }
+    }
+
+    unmap();
+    return rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+uint64_t contacts_cache::get_hash(const vector<record> &records)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const record &r : records)
+    {
+        auto bytes = reinterpret_cast<const unsigned char*>(&r);
+        for (size_t i = 0; i < sizeof(record); ++i)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+}
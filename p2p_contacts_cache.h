@@ -0,0 +1,65 @@
+#ifndef P2P_CONTACTS_CACHE_H
+#define P2P_CONTACTS_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+
+#include <p2p_common.h>
+#include "p2p_requests.h"
+
+namespace p2p
+{
+
+class contacts_cache
+{
+public:
+    using contacts_dictionary = std::unordered_map<std::string, friend_id_type>;
+
+    explicit contacts_cache(std::string path);
+    ~contacts_cache();
+
+    uint64_t version() const;
+    uint64_t hash() const;
+    size_t size() const;
+    bool find(const std::string &phone, friend_id_type &friend_id) const;
+    contacts_dictionary contacts() const;
+
+    bool apply(const contacts_delta &delta);
+
+private:
+    static constexpr size_t PHONE_SIZE = 32;
+    struct record
+    {
+        char phone[PHONE_SIZE];
+        uint64_t friend_id;
+    };
+    struct header
+    {
+        uint32_t magic;
+        uint32_t format;
+        uint64_t version;
+        uint64_t hash;
+        uint64_t count;
+    };
+
+    const std::string path;
+    mutable std::mutex cache_mutex;
+    struct mapping;
+    std::unique_ptr<mapping> mapped;
+    const header *head = nullptr;
+    const record *records = nullptr;
+
+    void map();
+    void unmap();
+    bool write(uint64_t version, const std::vector<record> &new_records);
+    static uint64_t get_hash(const std::vector<record> &records);
+};
+
+}
+
+#endif // P2P_CONTACTS_CACHE_H
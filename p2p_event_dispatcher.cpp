@@ -0,0 +1,49 @@
+#include "p2p_event_dispatcher.h"
+
+#include <cstddef>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include "p2p_events.h"
+#include "p2p_service_pool.h"
+
+using namespace std;
+
+namespace p2p
+{
+
+event_dispatcher::event_dispatcher() : handlers{make_shared<table>()}
+{
+}
+
+bool event_dispatcher::dispatch(const event::ptr &e) const
+{
+    auto t = atomic_load(&handlers);
+    const entry &en = (*t)[static_cast<size_t>(e->code())];
+    if (!en.h)
+    {
+        return false;
+    }
+
+    if (en.executor)
+    {
+        en.executor->get_service().post([h = en.h, e]{ h(e); });
+    }
+    else
+    {
+        en.h(e);
+    }
+    return true;
+}
+
+void event_dispatcher::set_handler(events_code code, handler h,
+                                   service_pool::ptr executor)
+{
+    lock_guard<mutex> lck(update_mutex);
+    auto t = make_shared<table>(*atomic_load(&handlers));
+    (*t)[static_cast<size_t>(code)] = entry{move(h), move(executor)};
+    atomic_store(&handlers, shared_ptr<const table>{move(t)});
+}
+
+}
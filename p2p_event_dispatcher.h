@@ -0,0 +1,54 @@
+#ifndef P2P_EVENT_DISPATCHER_H
+#define P2P_EVENT_DISPATCHER_H
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <boost/intrusive_ptr.hpp>
+#include "p2p_events.h"
+#include "p2p_service_pool.h"
+
+namespace p2p
+{
+
+class event_dispatcher
+{
+public:
+    event_dispatcher();
+
+    using handler = std::function<void(const event::ptr&)>;
+
+    template <typename Event, typename Handler>
+    void set_handler(Handler h, service_pool::ptr executor)
+    {
+        set_handler(Event::static_code,
+                    [h](const event::ptr &e)
+                    { h(boost::static_pointer_cast<Event>(e)); },
+                    std::move(executor));
+    }
+
+    template <typename Event>
+    void reset_handler()
+    {
+        set_handler(Event::static_code, nullptr, nullptr);
+    }
+
+    bool dispatch(const event::ptr &e) const;
+
+private:
+    struct entry
+    {
+        handler h;
+        service_pool::ptr executor;
+    };
+    using table = std::array<entry, EVENTS_COUNT>;
+    std::shared_ptr<const table> handlers;
+    std::mutex update_mutex;
+
+    void set_handler(events_code code, handler h, service_pool::ptr executor);
+};
+
+}
+
+#endif // P2P_EVENT_DISPATCHER_H
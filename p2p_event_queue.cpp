@@ -0,0 +1,183 @@
+#include "p2p_event_queue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "p2p_events.h"
+
+using namespace std;
+
+namespace p2p
+{
+
+namespace
+{
+
+size_t round_capacity(size_t capacity)
+{
+    size_t result = 2;
+    while (result < capacity)
+    {
+        result <<= 1;
+    }
+    return result;
+}
+
+}
+
+event_queue::event_queue(size_t capacity) :
+    cells{new cell[round_capacity(capacity)]},
+    mask{round_capacity(capacity) - 1}
+{
+    for (size_t i = 0; i <= mask; ++i)
+    {
+        cells[i].sequence.store(i, memory_order_relaxed);
+    }
+}
+
+bool event_queue::try_push(event::ptr e)
+{
+    size_t pos = enqueue_pos.load(memory_order_relaxed);
+    cell *c;
+    while (true)
+    {
+        c = &cells[pos & mask];
+        size_t seq = c->sequence.load(memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0)
+        {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                                  memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = enqueue_pos.load(memory_order_relaxed);
+        }
+    }
+
+    c->data = move(e);
+    c->sequence.store(pos + 1, memory_order_release);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (consumer_waiting.load(memory_order_relaxed))
+    {
+        notify();
+    }
+    return true;
+}
+
+void event_queue::push(event::ptr e)
+{
+    while (!try_push(e))
+    {
+        if (closed)
+        {
+            return;
+        }
+        notify();
+        this_thread::yield();
+    }
+}
+
+bool event_queue::try_pop(event::ptr &e)
+{
+    cell *c = &cells[dequeue_pos & mask];
+    size_t seq = c->sequence.load(memory_order_acquire);
+    if (seq != dequeue_pos + 1)
+    {
+        return false;
+    }
+
+    e = move(c->data);
+    c->data = nullptr;
+    c->sequence.store(dequeue_pos + mask + 1, memory_order_release);
+    ++dequeue_pos;
+    return true;
+}
+
+bool event_queue::empty() const
+{
+    const cell &c = cells[dequeue_pos & mask];
+    return c.sequence.load(memory_order_acquire) != dequeue_pos + 1;
+}
+
+bool event_queue::pop(event::ptr &e, const function<bool()> &interrupted)
+{
+    while (!try_pop(e))
+    {
+        if (!wait(interrupted))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t event_queue::pop(vector<event::ptr> &batch, size_t max,
+                        const function<bool()> &interrupted)
+{
+    size_t count = 0;
+    event::ptr e;
+    while (count < max && try_pop(e))
+    {
+        batch.push_back(move(e));
+        ++count;
+    }
+    if (count != 0 || max == 0)
+    {
+        return count;
+    }
+
+    if (!pop(e, interrupted))
+    {
+        return 0;
+    }
+    batch.push_back(move(e));
+    ++count;
+
+    while (count < max && try_pop(e))
+    {
+        batch.push_back(move(e));
+        ++count;
+    }
+    return count;
+}
+
+void event_queue::notify()
+{
+    lock_guard<mutex> lck(wait_mutex);
+    wait_cond_var.notify_one();
+}
+
+void event_queue::close()
+{
+    closed = true;
+}
+
+bool event_queue::wait(const function<bool()> &interrupted)
+{
+    unique_lock<mutex> lck(wait_mutex);
+    consumer_waiting.store(true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    wait_cond_var.wait(lck, [this, &interrupted]
+                       { return !empty() || interrupted(); });
+    consumer_waiting.store(false, memory_order_relaxed);
+
+    return !empty();
+}
+
+}
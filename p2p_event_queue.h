@@ -0,0 +1,55 @@
+#ifndef P2P_EVENT_QUEUE_H
+#define P2P_EVENT_QUEUE_H
+
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "p2p_events.h"
+
+namespace p2p
+{
+
+class event_queue
+{
+public:
+    explicit event_queue(size_t capacity);
+
+    bool try_push(event::ptr e);
+    void push(event::ptr e);
+
+    bool try_pop(event::ptr &e);
+    bool empty() const;
+    bool pop(event::ptr &e, const std::function<bool()> &interrupted);
+    size_t pop(std::vector<event::ptr> &batch, size_t max,
+               const std::function<bool()> &interrupted);
+
+    void notify();
+    void close();
+
+private:
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        event::ptr data;
+    };
+    std::unique_ptr<cell[]> cells;
+    const size_t mask;
+
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) size_t dequeue_pos = 0;
+
+    std::atomic<bool> closed{false};
+
+    alignas(64) std::atomic<bool> consumer_waiting{false};
+    std::mutex wait_mutex;
+    std::condition_variable wait_cond_var;
+    bool wait(const std::function<bool()> &interrupted);
+};
+
+}
+
+#endif // P2P_EVENT_QUEUE_H
@@ -1,2 +1,98 @@
 #include "p2p_events.h"
 
+#include <cstddef>
+#include <new>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace p2p
+{
+
+namespace
+{
+
+constexpr size_t BLOCK_ALIGNMENT = 16;
+constexpr size_t SIZE_CLASSES_COUNT = 8;
+constexpr size_t MAX_FREE_BLOCKS = 4096;
+
+class event_pool
+{
+public:
+    void *allocate(size_t size)
+    {
+        size_t index = size_class(size);
+        if (index >= SIZE_CLASSES_COUNT)
+        {
+            return ::operator new(size);
+        }
+
+        size_class_blocks &c = classes[index];
+        {
+            lock_guard<mutex> lck(c.blocks_mutex);
+            if (!c.blocks.empty())
+            {
+                void *p = c.blocks.back();
+                c.blocks.pop_back();
+                return p;
+            }
+        }
+        return ::operator new((index + 1) * BLOCK_ALIGNMENT);
+    }
+
+    void deallocate(void *p, size_t size) noexcept
+    {
+        size_t index = size_class(size);
+        if (index < SIZE_CLASSES_COUNT)
+        {
+            size_class_blocks &c = classes[index];
+            lock_guard<mutex> lck(c.blocks_mutex);
+            if (c.blocks.size() < MAX_FREE_BLOCKS)
+            {
+                try
+                {
+                    c.blocks.push_back(p);
+                    return;
+                }
+                catch (bad_alloc&)
+                {
+                }
+            }
+        }
+        ::operator delete(p);
+    }
+
+private:
+    struct size_class_blocks
+    {
+        mutex blocks_mutex;
+        vector<void*> blocks;
+    };
+    size_class_blocks classes[SIZE_CLASSES_COUNT];
+
+    static size_t size_class(size_t size)
+    {
+        return (size + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT - 1;
+    }
+};
+
+event_pool &get_pool()
+{
+    static event_pool *pool = new event_pool{};
+    return *pool;
+}
+
+}
+
+void *event::operator new(size_t size)
+{
+    return get_pool().allocate(size);
+}
+
+void event::operator delete(void *p, size_t size) noexcept
+{
+    get_pool().deallocate(p, size);
+}
+
+}
@@ -3,6 +3,10 @@
 
 #include <string>
 #include <memory>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <boost/intrusive_ptr.hpp>
 #include "p2p_common.h"
 
 namespace p2p
@@ -18,6 +22,14 @@ using event_code_type = int;
  * @brief Уникальный идентификатор события (в пределах объекта client)
  */
 using message_id_type = uint64_t;
+/**
+ * @brief Разделяемый (с подсчётом ссылок) буфер с текстом сообщения
+ *
+ * Текст входящего сообщения читается из сети непосредственно в такой буфер,
+ * исходящее сообщение передаётся в сеть прямо из буфера отправителя,
+ * без промежуточного копирования
+ */
+using message_buffer = std::shared_ptr<const std::string>;
 
 enum class events_code : event_code_type {
     DISCONNECTED, ///< событие disconnected_event
@@ -33,10 +45,19 @@ enum class events_code : event_code_type {
     FRIEND_NEW_MESSAGE, ///< событие friend_new_message_event
     FRIEND_MESSAGE_DELIVERED, ///< событие friend_message_delivered_event
     FRIEND_MESSAGE_READED, ///< событие friend_message_readed_event
+    RECONNECTED, ///< событие reconnected_event
 };
+/**
+ * @brief Количество кодов событий
+ */
+constexpr size_t EVENTS_COUNT =
+        static_cast<size_t>(events_code::RECONNECTED) + 1;
 
 /**
  * @brief Базовый класс событий
+ *
+ * Память под события выделяется из пула блоков фиксированных размеров и
+ * возвращается в него при освобождении последнего указателя на событие
  */
 class event
 {
@@ -46,9 +67,13 @@ public:
      */
     virtual ~event() {}
     /**
-     * @brief Умный указатель (с подсчётом ссылок) на событие
+     * @brief Умный указатель (со встроенным в событие счётчиком ссылок)
+     * на событие
+     *
+     * Для приведения к типу конкретного события используется
+     * static_pointer_cast (boost::static_pointer_cast)
      */
-    using ptr = std::shared_ptr<event>;
+    using ptr = boost::intrusive_ptr<event>;
 
     /**
      * @brief Возвращает код события
@@ -56,6 +81,9 @@ public:
      */
     events_code code() const noexcept { return code_value; }
 
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size) noexcept;
+
 protected:
     event(events_code code) noexcept :
         code_value{code}
@@ -64,16 +92,61 @@ protected:
 
 private:
     const events_code code_value;
+    mutable std::atomic<unsigned> ref_count{0};
+
+    friend void intrusive_ptr_add_ref(const event *e) noexcept
+    {
+        e->ref_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    friend void intrusive_ptr_release(const event *e) noexcept
+    {
+        if (e->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            delete e;
+        }
+    }
 };
 
+/**
+ * @brief Создать событие
+ * @param[in] args Параметры конструктора события
+ * @return Указатель на созданное событие
+ */
+template <typename Event, typename... Args>
+boost::intrusive_ptr<Event> make_event(Args&&... args)
+{
+    return boost::intrusive_ptr<Event>{new Event{std::forward<Args>(args)...}};
+}
+
 /**
  * @brief Закрытие соединения с сервером и всеми контактами
  */
 class disconnected_event : public event
 {
 public:
+    static constexpr events_code static_code = events_code::DISCONNECTED;
+
     disconnected_event() noexcept :
-        event{events_code::DISCONNECTED}
+        event{static_code}
+    {
+    }
+};
+
+/**
+ * @brief Соединение с сервером было автоматически восстановлено
+ *
+ * Генерируется только при включённом автоматическом переподключении
+ * (client::set_reconnect) после повторной проверки версии и восстановления
+ * авторизации; запросы и сообщения, отправленные до разрыва соединения,
+ * могли быть потеряны
+ */
+class reconnected_event : public event
+{
+public:
+    static constexpr events_code static_code = events_code::RECONNECTED;
+
+    reconnected_event() noexcept :
+        event{static_code}
     {
     }
 };
@@ -105,12 +178,14 @@ private:
  * @brief Шаблон для объявления событий, связанных с определённым контактом,
  * не содержащих дополнительных данных; нужен только для уменьшения объёма кода
  */
-template <events_code code>
+template <events_code event_code>
 class friend_event_code_template : public friend_event
 {
 public:
+    static constexpr events_code static_code = event_code;
+
     friend_event_code_template(friend_id_type friend_id) noexcept :
-        friend_event{code, friend_id}
+        friend_event{static_code, friend_id}
     {
     }
 };
@@ -124,9 +199,12 @@ public:
 class friend_status_updated_event : public friend_event
 {
 public:
+    static constexpr events_code static_code =
+            events_code::FRIEND_STATUS_UPDATED;
+
     friend_status_updated_event(friend_id_type friend_id,
                                 bool is_active) noexcept :
-        friend_event{events_code::FRIEND_STATUS_UPDATED, friend_id},
+        friend_event{static_code, friend_id},
         is_active_value{is_active}
     {
     }
@@ -190,63 +268,133 @@ using friend_disconnected_event =
 class friend_new_message_event : public friend_event
 {
 public:
+    static constexpr events_code static_code = events_code::FRIEND_NEW_MESSAGE;
+
     friend_new_message_event(friend_id_type friend_id,
-                             const std::string &message) noexcept :
-        friend_event{events_code::FRIEND_NEW_MESSAGE, friend_id},
-        message_value{message}
+                             message_buffer message,
+                             message_id_type message_id = 0) noexcept :
+        friend_event{static_code, friend_id},
+        message_value{std::move(message)},
+        message_id_value{message_id}
     {
     }
+    /**
+     * @brief Возвращает идентификатор сообщения, присвоенный отправителем;
+     * используется в client::confirm_reading и client::confirm_reading_up_to
+     * @return Идентификатор сообщения или 0, если сервер его не передал
+     */
+    message_id_type message_id() const noexcept { return message_id_value; }
     /**
      * @brief Возвращает текст сообщения
-     * @return Текст сообщения
+     * @return Ссылка на текст сообщения, действительная пока существует
+     * событие или полученный из него буфер
+     */
+    const std::string &message() const { return *message_value; }
+    /**
+     * @brief Возвращает буфер с текстом сообщения; позволяет хранить текст
+     * после освобождения события без копирования
+     * @return Буфер с текстом сообщения
      */
-    std::string message() const { return message_value; }
+    message_buffer buffer() const { return message_value; }
 
 private:
-    const std::string message_value;
+    const message_buffer message_value;
+    const message_id_type message_id_value;
 };
 
 /**
  * @brief Сообщение было доставлено
+ *
+ * При включённом режиме client::set_range_events одно событие
+ * подтверждает доставку всех сообщений контакту с идентификаторами
+ * от first_message_id() до message_id() включительно
  */
 class friend_message_delivered_event : public friend_event
 {
 public:
+    static constexpr events_code static_code =
+            events_code::FRIEND_MESSAGE_DELIVERED;
+
+    friend_message_delivered_event(friend_id_type friend_id,
+                                   message_id_type message_id) :
+        friend_message_delivered_event{friend_id, message_id, message_id}
+    {
+    }
     friend_message_delivered_event(friend_id_type friend_id,
+                                   message_id_type first_message_id,
                                    message_id_type message_id) :
-        friend_event{events_code::FRIEND_MESSAGE_DELIVERED, friend_id},
+        friend_event{static_code, friend_id},
+        first_message_id_value{first_message_id},
         message_id_value{message_id}
     {
     }
+    /**
+     * @brief Возвращает идентификатор первого доставленного
+     * сообщения диапазона
+     * @return Идентификатор первого сообщения; совпадает с
+     * message_id(), если событие относится к одному сообщению
+     */
+    message_id_type first_message_id() const
+    {
+        return first_message_id_value;
+    }
     /**
      * @brief Возвращает идентификатор доставленного сообщения
+     * (последнего в диапазоне)
      * @return Идентификатор доставленного сообщения
      */
     message_id_type message_id() const { return message_id_value; }
 
 private:
+    const message_id_type first_message_id_value;
     const message_id_type message_id_value;
 };
 
 /**
  * @brief Сообщение было прочитано
+ *
+ * При включённом режиме client::set_range_events одно событие
+ * сообщает о прочтении всех сообщений контакту с идентификаторами
+ * от first_message_id() до message_id() включительно
  */
 class friend_message_readed_event : public friend_event
 {
 public:
+    static constexpr events_code static_code =
+            events_code::FRIEND_MESSAGE_READED;
+
+    friend_message_readed_event(friend_id_type friend_id,
+                                message_id_type message_id) :
+        friend_message_readed_event{friend_id, message_id, message_id}
+    {
+    }
     friend_message_readed_event(friend_id_type friend_id,
+                                message_id_type first_message_id,
                                 message_id_type message_id) :
-        friend_event{events_code::FRIEND_MESSAGE_DELIVERED, friend_id},
+        friend_event{static_code, friend_id},
+        first_message_id_value{first_message_id},
         message_id_value{message_id}
     {
     }
+    /**
+     * @brief Возвращает идентификатор первого прочитанного
+     * сообщения диапазона
+     * @return Идентификатор первого сообщения; совпадает с
+     * message_id(), если событие относится к одному сообщению
+     */
+    message_id_type first_message_id() const
+    {
+        return first_message_id_value;
+    }
     /**
      * @brief Возвращает идентификатор прочитанного сообщения
+     * (последнего в диапазоне)
      * @return Идентификатор прочитанного сообщения
      */
     message_id_type message_id() const { return message_id_value; }
 
 private:
+    const message_id_type first_message_id_value;
     const message_id_type message_id_value;
 };
 
@@ -0,0 +1,188 @@
+#include "p2p_notifications.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <array>
+#include <limits>
+
+#include <p2p_common.h>
+#include "p2p_events.h"
+#include "p2p_codec.h"
+#include "p2p_requests.h"
+
+using namespace std;
+
+namespace p2p {
+
+namespace
+{
+
+using notification_reader = event::ptr (*)(frame_reader&, friend_id_type);
+
+template <typename Event>
+event::ptr read_friend_event(frame_reader&, friend_id_type friend_id)
+{
+    return make_event<Event>(friend_id);
+}
+
+template <typename Event>
+event::ptr read_message_event(frame_reader &reader, friend_id_type friend_id)
+{
+    auto message_id = static_cast<message_id_type>(reader.read_uint());
+    if (reader.is_empty())
+    {
+        return make_event<Event>(friend_id, message_id);
+    }
+    if (reader.read_string() != CUMULATIVE_ACK)
+    {
+        return nullptr;
+    }
+    return make_event<Event>(friend_id, message_id_type{0}, message_id);
+}
+
+event::ptr read_status_event(frame_reader &reader, friend_id_type friend_id)
+{
+    uint64_t status = reader.read_uint();
+    if (status > 1)
+    {
+        return nullptr;
+    }
+    return make_event<friend_status_updated_event>(friend_id, status == 1);
+}
+
+struct readers_table
+{
+    array<notification_reader, OPCODES_COUNT> readers{};
+
+    readers_table()
+    {
+        add(opcode::FRIEND_STATUS_UPDATED, read_status_event);
+        add(opcode::FRIEND_WANTED_TO_CONNECT,
+            read_friend_event<friend_wanted_to_connect_event>);
+        add(opcode::FRIEND_WANTED_TO_STOP_CONNECTION,
+            read_friend_event<friend_wanted_to_stop_connection_event>);
+        add(opcode::FRIEND_CONFIRMED_CONNECTION,
+            read_friend_event<friend_confirmed_connection_event>);
+        add(opcode::FRIEND_DISCARDED_CONNECTION,
+            read_friend_event<friend_discarded_connection_event>);
+        add(opcode::FRIEND_CONNECTED,
+            read_friend_event<friend_connected_event>);
+        add(opcode::FRIEND_WANTED_TO_DISCONNECT,
+            read_friend_event<friend_wanted_to_disconnect>);
+        add(opcode::FRIEND_DISCONNECTED,
+            read_friend_event<friend_disconnected_event>);
+        add(opcode::FRIEND_MESSAGE_DELIVERED,
+            read_message_event<friend_message_delivered_event>);
+        add(opcode::FRIEND_MESSAGE_READED,
+            read_message_event<friend_message_readed_event>);
+    }
+
+    void add(opcode op, notification_reader reader)
+    {
+        readers[static_cast<size_t>(op)] = reader;
+    }
+};
+
+const readers_table notification_readers;
+
+}
+
+event::ptr read_notification(frame_reader &reader)
+{
+    try
+    {
+        auto op = static_cast<size_t>(reader.read_command());
+        notification_reader read = notification_readers.readers[op];
+        if (!read || reader.read_uint() != 0)
+        {
+            return nullptr;
+        }
+
+        auto friend_id = static_cast<friend_id_type>(reader.read_uint());
+        event::ptr e = read(reader, friend_id);
+        if (!reader.is_empty())
+        {
+            return nullptr;
+        }
+        return e;
+    }
+    catch (invalid_token_exception&)
+    {
+        return nullptr;
+    }
+}
+
+bool read_confirmed_connection(frame_reader &reader, friend_id_type &friend_id,
+                               peer_endpoint &endpoint)
+{
+    try
+    {
+        if (reader.read_command() != opcode::FRIEND_CONFIRMED_CONNECTION ||
+            reader.read_uint() != 0)
+        {
+            return false;
+        }
+
+        friend_id = static_cast<friend_id_type>(reader.read_uint());
+        if (reader.is_empty())
+        {
+            return false;
+        }
+        endpoint.address = reader.read_string();
+        uint64_t port = reader.read_uint();
+        if (port == 0 || port > numeric_limits<uint16_t>::max())
+        {
+            return false;
+        }
+        endpoint.port = static_cast<uint16_t>(port);
+        endpoint.token = reader.read_uint();
+        if (!reader.is_empty())
+        {
+            endpoint.datagram = reader.read_string() == DATAGRAM_TRANSPORT;
+            if (!endpoint.datagram)
+            {
+                return false;
+            }
+        }
+        return reader.is_empty();
+    }
+    catch (invalid_token_exception&)
+    {
+        return false;
+    }
+}
+
+bool read_new_message_header(frame_reader &reader, friend_id_type &friend_id,
+                             message_id_type &message_id, size_t &message_size)
+{
+    try
+    {
+        if (reader.read_command() != opcode::FRIEND_NEW_MESSAGE ||
+            reader.read_uint() != 0)
+        {
+            return false;
+        }
+
+        friend_id = static_cast<friend_id_type>(reader.read_uint());
+        uint64_t size = reader.read_uint();
+        message_id = 0;
+        if (!reader.is_empty())
+        {
+            message_id = static_cast<message_id_type>(size);
+            size = reader.read_uint();
+        }
+        if (size > numeric_limits<size_t>::max())
+        {
+            return false;
+        }
+        message_size = static_cast<size_t>(size);
+        return reader.is_empty();
+    }
+    catch (invalid_token_exception&)
+    {
+        return false;
+    }
+}
+
+}//p2p
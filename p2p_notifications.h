@@ -0,0 +1,43 @@
+#ifndef P2P_NOTIFICATIONS_H
+#define P2P_NOTIFICATIONS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include <p2p_common.h>
+#include "p2p_events.h"
+#include "p2p_codec.h"
+
+namespace p2p {
+
+const std::string FRIEND_STATUS_UPDATED = "FRIEND_STATUS_UPDATED";
+const std::string FRIEND_WANTED_TO_CONNECT = "FRIEND_WANTED_TO_CONNECT";
+const std::string FRIEND_WANTED_TO_STOP_CONNECTION =
+        "FRIEND_WANTED_TO_STOP_CONNECTION";
+const std::string FRIEND_CONFIRMED_CONNECTION = "FRIEND_CONFIRMED_CONNECTION";
+const std::string FRIEND_DISCARDED_CONNECTION = "FRIEND_DISCARDED_CONNECTION";
+const std::string FRIEND_CONNECTED = "FRIEND_CONNECTED";
+const std::string FRIEND_WANTED_TO_DISCONNECT = "FRIEND_WANTED_TO_DISCONNECT";
+const std::string FRIEND_DISCONNECTED = "FRIEND_DISCONNECTED";
+const std::string FRIEND_MESSAGE_DELIVERED = "FRIEND_MESSAGE_DELIVERED";
+const std::string FRIEND_MESSAGE_READED = "FRIEND_MESSAGE_READED";
+const std::string FRIEND_NEW_MESSAGE = "FRIEND_NEW_MESSAGE";
+
+struct peer_endpoint
+{
+    std::string address;
+    uint16_t port = 0;
+    uint64_t token = 0;
+    bool datagram = false;
+};
+
+event::ptr read_notification(frame_reader &reader);
+bool read_confirmed_connection(frame_reader &reader, friend_id_type &friend_id,
+                               peer_endpoint &endpoint);
+bool read_new_message_header(frame_reader &reader, friend_id_type &friend_id,
+                             message_id_type &message_id, size_t &message_size);
+
+}//p2p
+
+#endif // P2P_NOTIFICATIONS_H
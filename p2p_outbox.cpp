@@ -0,0 +1,327 @@
+#include "p2p_outbox.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/exceptions.hpp>
+
+#include <p2p_common.h>
+
+using namespace std;
+namespace ipc = boost::interprocess;
+
+namespace p2p
+{
+
+namespace
+{
+
+constexpr uint32_t OUTBOX_MAGIC = 0x50324f42;
+constexpr uint32_t OUTBOX_FORMAT = 1;
+constexpr uint32_t RECORD_PENDING = 1;
+constexpr uint32_t RECORD_DELIVERED = 2;
+constexpr size_t RECORD_ALIGNMENT = 8;
+constexpr size_t INITIAL_CAPACITY = 64 * 1024;
+
+bool append_zeros(const string &path, size_t size)
+{
+    ofstream out{path, ios::binary | ios::app};
+    vector<char> zeros(min<size_t>(size, INITIAL_CAPACITY));
+    while (out && size > 0)
+    {
+        size_t chunk = min(size, zeros.size());
+        out.write(zeros.data(), chunk);
+        size -= chunk;
+    }
+    return static_cast<bool>(out);
+}
+
+}
+
+struct outbox::mapping
+{
+    ipc::file_mapping file;
+    ipc::mapped_region region;
+};
+
+outbox::outbox(string path) : path{std::move(path)}
+{
+    map();
+    if (!head && create())
+    {
+        map();
+    }
+}
+
+outbox::~outbox()
+{
+}
+
+message_id_type outbox::last_message_id() const
+{
+    lock_guard<mutex> lck(outbox_mutex);
+    return head ? head->last_message_id : 0;
+}
+
+size_t outbox::size() const
+{
+    lock_guard<mutex> lck(outbox_mutex);
+    size_t count = 0;
+    for (const auto &f : index)
+    {
+        count += f.second.size();
+    }
+    return count;
+}
+
+vector<outbox::message> outbox::pending() const
+{
+    lock_guard<mutex> lck(outbox_mutex);
+    vector<message> result;
+    for (const auto &f : index)
+    {
+        for (const auto &m : f.second)
+        {
+            const record *r = record_at(m.second);
+            auto text = reinterpret_cast<const char*>(r + 1);
+            result.push_back({f.first, m.first,
+                              make_shared<const string>(text, r->size)});
+        }
+    }
+    return result;
+}
+
+bool outbox::append(friend_id_type friend_id, message_id_type message_id,
+                    const string &text)
+{
+    lock_guard<mutex> lck(outbox_mutex);
+    size_t size = record_size(text.size());
+    if (!head || text.size() > numeric_limits<uint32_t>::max())
+    {
+        return false;
+    }
+    if (head->used + size > capacity)
+    {
+        bool reclaimed = sizeof(header) + live_bytes + size <= capacity / 2 &&
+                compact();
+        if (!reclaimed && !grow(head->used + size))
+        {
+            return false;
+        }
+    }
+
+    uint64_t offset = head->used;
+    record *r = record_at(offset);
+    r->state = RECORD_PENDING;
+    r->size = static_cast<uint32_t>(text.size());
+    r->friend_id = static_cast<uint64_t>(friend_id);
+    r->message_id = message_id;
+    memcpy(r + 1, text.data(), text.size());
+    head->last_message_id = max<uint64_t>(head->last_message_id, message_id);
+    head->used = offset + size;
+    mapped->region.flush(static_cast<size_t>(offset), size, true);
+    mapped->region.flush(0, sizeof(header), true);
+
+    index[friend_id][message_id] = offset;
+    live_bytes += size;
+    return true;
+}
+
+void outbox::remove(friend_id_type friend_id, message_id_type first,
+                    message_id_type last)
+{
+    lock_guard<mutex> lck(outbox_mutex);
+    auto f = index.find(friend_id);
+    if (!head || f == index.end())
+    {
+        return;
+    }
+
+    auto &messages = f->second;
+    auto begin = messages.lower_bound(first);
+    auto end = messages.upper_bound(last);
+    if (begin == end)
+    {
+        return;
+    }
+    for (auto it = begin; it != end; ++it)
+    {
+        record *r = record_at(it->second);
+        r->state = RECORD_DELIVERED;
+        live_bytes -= record_size(r->size);
+        mapped->region.flush(static_cast<size_t>(it->second), sizeof(record),
+                             true);
+    }
+    messages.erase(begin, end);
+    if (messages.empty())
+    {
+        index.erase(f);
+    }
+    if (index.empty())
+    {
+        head->used = sizeof(header);
+        mapped->region.flush(0, sizeof(header), true);
+    }
+}
+
+void outbox::map()
+{
+    unmap();
+
+    try
+    {
+        auto m = make_unique<mapping>();
+        m->file = ipc::file_mapping{path.c_str(), ipc::read_write};
+        m->region = ipc::mapped_region{m->file, ipc::read_write};
+        if (m->region.get_size() < sizeof(header))
+        {
+            return;
+        }
+
+        auto h = static_cast<header*>(m->region.get_address());
+        if (h->magic != OUTBOX_MAGIC || h->format != OUTBOX_FORMAT ||
+            h->used < sizeof(header) || h->used > m->region.get_size())
+        {
+            return;
+        }
+
+        mapped = std::move(m);
+        head = h;
+        capacity = mapped->region.get_size();
+        load();
+    }
+    catch (ipc::interprocess_exception&)
+    {
+    }
+}
+
+void outbox::unmap()
+{
+    head = nullptr;
+    capacity = 0;
+    live_bytes = 0;
+    index.clear();
+    mapped.reset();
+}
+
+void outbox::load()
+{
+    uint64_t offset = sizeof(header);
+    while (offset + sizeof(record) <= head->used)
+    {
+        const record *r = record_at(offset);
+        size_t size = record_size(r->size);
+        if ((r->state != RECORD_PENDING && r->state != RECORD_DELIVERED) ||
+            offset + size > head->used)
+        {
+            break;
+        }
+        if (r->state == RECORD_PENDING)
+        {
+            index[static_cast<friend_id_type>(r->friend_id)][r->message_id] =
+                    offset;
+            live_bytes += size;
+        }
+        offset += size;
+    }
+    head->used = offset;
+}
+
+bool outbox::create()
+{
+    string tmp_path = path + ".tmp";
+    {
+        ofstream out{tmp_path, ios::binary | ios::trunc};
+        header h{OUTBOX_MAGIC, OUTBOX_FORMAT, 0, sizeof(header), 0};
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        if (!out)
+        {
+            return false;
+        }
+    }
+    if (!append_zeros(tmp_path, INITIAL_CAPACITY - sizeof(header)))
+    {
+        return false;
+    }
+
+    unmap();
+    return rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+bool outbox::grow(size_t required)
+{
+    size_t new_capacity = max(capacity * 2, INITIAL_CAPACITY);
+    while (new_capacity < required)
+    {
+        new_capacity *= 2;
+    }
+
+    size_t old_capacity = capacity;
+    unmap();
+    bool grown = append_zeros(path, new_capacity - old_capacity);
+    map();
+    return grown && head && capacity >= required;
+}
+
+bool outbox::compact()
+{
+    vector<uint64_t> offsets;
+    for (const auto &f : index)
+    {
+        for (const auto &m : f.second)
+        {
+            offsets.push_back(m.second);
+        }
+    }
+    sort(offsets.begin(), offsets.end());
+
+    string tmp_path = path + ".tmp";
+    {
+        ofstream out{tmp_path, ios::binary | ios::trunc};
+        header h{OUTBOX_MAGIC, OUTBOX_FORMAT, head->last_message_id,
+                 sizeof(header) + live_bytes, 0};
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        for (uint64_t offset : offsets)
+        {
+            const record *r = record_at(offset);
+            out.write(reinterpret_cast<const char*>(r), record_size(r->size));
+        }
+        if (!out)
+        {
+            return false;
+        }
+    }
+    if (!append_zeros(tmp_path, capacity - sizeof(header) - live_bytes))
+    {
+        return false;
+    }
+
+    unmap();
+    bool renamed = rename(tmp_path.c_str(), path.c_str()) == 0;
+    map();
+    return renamed && head;
+}
+
+outbox::record *outbox::record_at(uint64_t offset) const
+{
+    return reinterpret_cast<record*>(reinterpret_cast<char*>(head) + offset);
+}
+
+size_t outbox::record_size(size_t text_size)
+{
+    size_t size = sizeof(record) + text_size;
+    return (size + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+}
+
+}
@@ -0,0 +1,80 @@
+#ifndef P2P_OUTBOX_H
+#define P2P_OUTBOX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+
+#include <p2p_common.h>
+#include "p2p_events.h"
+
+namespace p2p
+{
+
+class outbox
+{
+public:
+    struct message
+    {
+        friend_id_type friend_id;
+        message_id_type message_id;
+        message_buffer text;
+    };
+
+    explicit outbox(std::string path);
+    ~outbox();
+
+    message_id_type last_message_id() const;
+    size_t size() const;
+    std::vector<message> pending() const;
+
+    bool append(friend_id_type friend_id, message_id_type message_id,
+                const std::string &text);
+    void remove(friend_id_type friend_id, message_id_type first,
+                message_id_type last);
+
+private:
+    struct header
+    {
+        uint32_t magic;
+        uint32_t format;
+        uint64_t last_message_id;
+        uint64_t used;
+        uint64_t reserved;
+    };
+    struct record
+    {
+        uint32_t state;
+        uint32_t size;
+        uint64_t friend_id;
+        uint64_t message_id;
+    };
+
+    const std::string path;
+    mutable std::mutex outbox_mutex;
+    struct mapping;
+    std::unique_ptr<mapping> mapped;
+    header *head = nullptr;
+    size_t capacity = 0;
+    size_t live_bytes = 0;
+    std::unordered_map<friend_id_type,
+                       std::map<message_id_type, uint64_t>> index;
+
+    void map();
+    void unmap();
+    void load();
+    bool create();
+    bool grow(size_t required);
+    bool compact();
+    record *record_at(uint64_t offset) const;
+    static size_t record_size(size_t text_size);
+};
+
+}
+
+#endif // P2P_OUTBOX_H
@@ -0,0 +1,297 @@
+#include "p2p_peer_link.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <limits>
+#include <boost/asio.hpp>
+
+#include "p2p_common.h"
+#include "p2p_events.h"
+#include "p2p_codec.h"
+
+using namespace std;
+using namespace boost::asio;
+using boost::asio::ip::tcp;
+using boost_error = boost::system::error_code;
+
+namespace p2p
+{
+
+constexpr size_t MAX_PEER_BATCH_FRAMES = 64;
+
+void write_peer_frame(pooled_buffer &buf, size_t &buf_size,
+                      const peer_link::frame &f)
+{
+    frame_writer writer{encoding::BINARY, buf, buf_size};
+    writer.write_command(f.command);
+    writer.append_uint(f.value);
+    if (f.command == opcode::PEER_MESSAGE)
+    {
+        writer.append_uint(f.body ? f.body->size() : 0);
+    }
+    writer.finalize();
+}
+
+bool read_peer_frame(const char *data, size_t size, opcode &command,
+                     uint64_t &value, uint64_t &body_size)
+{
+    body_size = 0;
+    try
+    {
+        frame_reader reader{encoding::BINARY, data, size};
+        command = reader.read_command();
+        value = reader.read_uint();
+        if (command == opcode::PEER_MESSAGE)
+        {
+            body_size = reader.read_uint();
+        }
+        return reader.is_empty() && body_size <= MAX_PEER_MESSAGE_SIZE;
+    }
+    catch (invalid_token_exception&)
+    {
+        return false;
+    }
+}
+
+tcp_peer_link::tcp_peer_link(io_service &service, io_service::strand strand) :
+    strand{strand}, link_socket{service}
+{
+}
+
+tcp_peer_link::ptr tcp_peer_link::create(io_service &service,
+                                         io_service::strand strand)
+{
+    return ptr{new tcp_peer_link{service, strand}};
+}
+
+void tcp_peer_link::start(frame_handler handler, close_handler closed)
+{
+    on_frame = move(handler);
+    on_close = move(closed);
+    open = true;
+    decoder.reset(encoding::BINARY);
+    boost_error ec;
+    link_socket.set_option(tcp::no_delay{true}, ec);
+    start_read();
+    if (!write_queue.empty() && !writing)
+    {
+        start_write();
+    }
+}
+
+void tcp_peer_link::send(opcode command, uint64_t value, message_buffer body)
+{
+    write_queue.push_back({command, value, move(body)});
+    if (open && !writing)
+    {
+        start_write();
+    }
+}
+
+void tcp_peer_link::close()
+{
+    open = false;
+    on_frame = nullptr;
+    on_close = nullptr;
+    write_queue.clear();
+    boost_error ec;
+    link_socket.shutdown(tcp::socket::shutdown_both, ec);
+    link_socket.close(ec);
+    decoder.reset(encoding::BINARY);
+    decoder.release();
+}
+
+void tcp_peer_link::close_when_sent()
+{
+    on_frame = nullptr;
+    on_close = nullptr;
+    closing = true;
+    if (!writing)
+    {
+        close();
+    }
+}
+
+void tcp_peer_link::fail()
+{
+    if (!open)
+    {
+        return;
+    }
+
+    auto handler = move(on_close);
+    close();
+    if (handler)
+    {
+        handler();
+    }
+}
+
+void tcp_peer_link::start_write()
+{
+    write_buf_size = 0;
+    write_bodies.clear();
+    vector<size_t> ends;
+    while (!write_queue.empty() && ends.size() < MAX_PEER_BATCH_FRAMES)
+    {
+        frame f = move(write_queue.front());
+        write_queue.pop_front();
+
+        write_peer_frame(write_buf, write_buf_size, f);
+        ends.push_back(write_buf_size);
+        write_bodies.push_back(move(f.body));
+    }
+
+    writing = !ends.empty();
+    if (!writing)
+    {
+        write_buf.release();
+        if (closing)
+        {
+            close();
+        }
+        return;
+    }
+
+    vector<const_buffer> buffers;
+    buffers.reserve(2 * ends.size());
+    size_t begin = 0;
+    for (size_t i = 0; i < ends.size(); ++i)
+    {
+        buffers.push_back(buffer(write_buf.data() + begin, ends[i] - begin));
+        if (write_bodies[i] && !write_bodies[i]->empty())
+        {
+            buffers.push_back(buffer(*write_bodies[i]));
+        }
+        begin = ends[i];
+    }
+
+    async_write(link_socket, buffers, strand.wrap(
+                [self = shared_from_this()](boost_error ec, size_t)
+                {
+                    if (ec == error::operation_aborted || !self->open)
+                    {
+                        return;
+                    }
+                    self->writing = false;
+                    if (ec)
+                    {
+                        self->fail();
+                        return;
+                    }
+                    self->start_write();
+                }));
+}
+
+void tcp_peer_link::start_read()
+{
+    decoder.prepare();
+    link_socket.async_read_some(
+                buffer(decoder.free_space(), decoder.free_size()), strand.wrap(
+                [self = shared_from_this()](boost_error ec, size_t bytes)
+                {
+                    if (ec == error::operation_aborted || !self->open)
+                    {
+                        return;
+                    }
+                    if (ec)
+                    {
+                        self->fail();
+                        return;
+                    }
+                    self->decoder.commit(bytes);
+                    self->read_frames();
+                }));
+}
+
+void tcp_peer_link::read_frames()
+{
+    const char *data;
+    size_t size;
+    while (open && !reading_body)
+    {
+        switch (decoder.next(data, size))
+        {
+        case frame_decoder::status::FRAME:
+            if (!read_frame(data, size))
+            {
+                fail();
+                return;
+            }
+            break;
+        case frame_decoder::status::NEED_MORE:
+            start_read();
+            return;
+        case frame_decoder::status::INVALID:
+            fail();
+            return;
+        }
+    }
+}
+
+bool tcp_peer_link::read_frame(const char *data, size_t size)
+{
+    opcode command;
+    uint64_t value;
+    uint64_t body_size;
+    if (!read_peer_frame(data, size, command, value, body_size))
+    {
+        return false;
+    }
+
+    if (command == opcode::PEER_MESSAGE)
+    {
+        read_body(command, value, static_cast<size_t>(body_size));
+        return true;
+    }
+
+    if (on_frame)
+    {
+        on_frame({command, value, nullptr});
+    }
+    return true;
+}
+
+void tcp_peer_link::read_body(opcode command, uint64_t value, size_t size)
+{
+    auto body = make_shared<string>(size, '\0');
+    size_t buffered = decoder.read_raw(&(*body)[0], size);
+    if (buffered == size)
+    {
+        if (on_frame)
+        {
+            on_frame({command, value, body});
+        }
+        return;
+    }
+
+    reading_body = true;
+    async_read(link_socket, buffer(&(*body)[buffered], size - buffered),
+               strand.wrap(
+               [self = shared_from_this(), command, value, body]
+               (boost_error ec, size_t)
+               {
+                   if (ec == error::operation_aborted || !self->open)
+                   {
+                       return;
+                   }
+                   self->reading_body = false;
+                   if (ec)
+                   {
+                       self->fail();
+                       return;
+                   }
+                   if (self->on_frame)
+                   {
+                       self->on_frame({command, value, body});
+                   }
+                   self->read_frames();
+               }));
+}
+
+}
@@ -0,0 +1,107 @@
+#ifndef P2P_PEER_LINK_H
+#define P2P_PEER_LINK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <boost/asio.hpp>
+
+#include "p2p_common.h"
+#include "p2p_events.h"
+#include "p2p_codec.h"
+#include "p2p_buffer_pool.h"
+
+namespace p2p
+{
+
+const std::string PEER_HELLO = "PEER_HELLO";
+const std::string PEER_MESSAGE = "PEER_MESSAGE";
+const std::string PEER_DELIVERED = "PEER_DELIVERED";
+const std::string PEER_READED = "PEER_READED";
+const std::string PEER_BYE = "PEER_BYE";
+const std::string PEER_PING = "PEER_PING";
+const std::string PEER_PONG = "PEER_PONG";
+const std::string PEER_DELIVERED_UP_TO = "PEER_DELIVERED_UP_TO";
+const std::string PEER_READED_UP_TO = "PEER_READED_UP_TO";
+
+constexpr size_t MAX_PEER_MESSAGE_SIZE = 16 * 1024 * 1024;
+
+class peer_link
+{
+public:
+    using ptr = std::shared_ptr<peer_link>;
+    virtual ~peer_link() {}
+
+    struct frame
+    {
+        opcode command;
+        uint64_t value;
+        message_buffer body;
+    };
+    using frame_handler = std::function<void(const frame&)>;
+    using close_handler = std::function<void()>;
+
+    virtual void start(frame_handler handler, close_handler on_close) = 0;
+    virtual void send(opcode command, uint64_t value,
+                      message_buffer body = nullptr) = 0;
+    virtual void close() = 0;
+    virtual void close_when_sent() = 0;
+    virtual bool is_open() const = 0;
+    virtual bool has_gaps() const { return false; }
+};
+
+void write_peer_frame(pooled_buffer &buf, size_t &buf_size,
+                      const peer_link::frame &f);
+bool read_peer_frame(const char *data, size_t size, opcode &command,
+                     uint64_t &value, uint64_t &body_size);
+
+class tcp_peer_link : public peer_link,
+                      public std::enable_shared_from_this<tcp_peer_link>
+{
+    tcp_peer_link(boost::asio::io_service &service,
+                  boost::asio::io_service::strand strand);
+
+public:
+    using ptr = std::shared_ptr<tcp_peer_link>;
+    static ptr create(boost::asio::io_service &service,
+                      boost::asio::io_service::strand strand);
+
+    boost::asio::ip::tcp::socket &socket() { return link_socket; }
+    void start(frame_handler handler, close_handler on_close) override;
+    void send(opcode command, uint64_t value,
+              message_buffer body = nullptr) override;
+    void close() override;
+    void close_when_sent() override;
+    bool is_open() const override { return open; }
+
+private:
+    boost::asio::io_service::strand strand;
+    boost::asio::ip::tcp::socket link_socket;
+    bool open = false;
+    bool closing = false;
+    frame_handler on_frame;
+    close_handler on_close;
+
+    std::deque<frame> write_queue;
+    bool writing = false;
+    pooled_buffer write_buf;
+    size_t write_buf_size = 0;
+    std::vector<message_buffer> write_bodies;
+    frame_decoder decoder;
+    bool reading_body = false;
+
+    void fail();
+    void start_write();
+    void start_read();
+    void read_frames();
+    bool read_frame(const char *data, size_t size);
+    void read_body(opcode command, uint64_t value, size_t size);
+};
+
+}
+
+#endif // P2P_PEER_LINK_H
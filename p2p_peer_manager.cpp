@@ -0,0 +1,1282 @@
+#include "p2p_peer_manager.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <boost/asio.hpp>
+
+#include "p2p_common.h"
+#include "p2p_events.h"
+#include "p2p_requests.h"
+#include "p2p_connection.h"
+#include "p2p_notifications.h"
+#include "p2p_peer_link.h"
+#include "p2p_udp_peer_link.h"
+
+using namespace std;
+using namespace boost::asio;
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+using boost_error = boost::system::error_code;
+using std::chrono::steady_clock;
+using std::chrono::microseconds;
+using std::chrono::duration_cast;
+
+namespace p2p
+{
+
+const boost::posix_time::seconds DIRECT_CONNECT_TIMEOUT{3};
+const boost::posix_time::seconds DIRECT_ACCEPT_TIMEOUT{5};
+const boost::posix_time::seconds PROBE_INTERVAL{1};
+constexpr size_t MAX_PENDING_LINKS = 16;
+constexpr double MAX_PATH_LOSS = 0.9;
+constexpr int64_t SWITCH_MARGIN_PERCENT = 80;
+const std::chrono::milliseconds RELAY_LOSS_TIMEOUT_MIN{1000};
+const std::chrono::milliseconds RELAY_LOSS_TIMEOUT_MAX{10000};
+constexpr size_t MAX_TRACKED_RECEIPTS = 65536;
+constexpr size_t MAX_SEEN_MESSAGES = 4096;
+
+namespace
+{
+
+void remember(deque<message_id_type> &ids, message_id_type id)
+{
+    auto pos = ids.end();
+    while (pos != ids.begin() && *prev(pos) > id)
+    {
+        --pos;
+    }
+    ids.insert(pos, id);
+    if (ids.size() > MAX_TRACKED_RECEIPTS)
+    {
+        ids.pop_front();
+    }
+}
+
+}
+
+void peer_manager::path::add_sample(bool lost)
+{
+    loss += ((lost ? 1.0 : 0.0) - loss) / 8;
+}
+
+microseconds peer_manager::path::cost() const
+{
+    if (!rtt.has_samples())
+    {
+        return microseconds{0};
+    }
+
+    double l = min(loss, MAX_PATH_LOSS);
+    auto rto = rtt.srtt() + 4 * rtt.rttvar();
+    return rtt.srtt() + duration_cast<microseconds>(rto * (l / (1 - l)));
+}
+
+peer_manager::peer_manager(io_service &service, connection::ptr con) :
+    service(service), strand{service}, con{move(con)}, acceptor{service},
+    probe_timer{service}, random{random_device{}()}
+{
+}
+
+peer_manager::ptr peer_manager::create(io_service &service, connection::ptr con)
+{
+    return ptr{new peer_manager{service, move(con)}};
+}
+
+void peer_manager::set_event_handler(connection::event_handler handler)
+{
+    on_event = move(handler);
+}
+
+void peer_manager::connect_to_client(friend_id_type friend_id)
+{
+    strand.post([self = shared_from_this(), friend_id]
+    {
+        if (self->peers.count(friend_id))
+        {
+            return;
+        }
+        self->peers[friend_id].state = peer_state::REQUESTED;
+        self->con->post_request(make_unique<friend_request>(
+                                    opcode::CONNECT_TO_CLIENT, friend_id));
+    });
+}
+
+void peer_manager::confirm_connection(friend_id_type friend_id)
+{
+    strand.post([self = shared_from_this(), friend_id]
+    {
+        auto it = self->peers.find(friend_id);
+        if (it == self->peers.end() || it->second.state != peer_state::WANTED)
+        {
+            return;
+        }
+
+        peer &p = it->second;
+        if (self->datagram && self->listen_datagram(friend_id, p))
+        {
+            self->start_timer(friend_id, p, DIRECT_ACCEPT_TIMEOUT);
+            return;
+        }
+        if (self->datagram || !self->start_listening())
+        {
+            self->con->post_request(make_unique<friend_request>(
+                                        opcode::CONFIRM_CONNECTION, friend_id));
+            self->go_relay(friend_id, p);
+            return;
+        }
+
+        p.state = peer_state::LISTENING;
+        p.token = self->random() | 1;
+        self->con->post_request(make_unique<confirm_connection_request>(
+                                    friend_id,
+                                    self->acceptor.local_endpoint().address()
+                                    .to_string(),
+                                    self->acceptor.local_endpoint().port(),
+                                    p.token, false));
+        self->start_timer(friend_id, p, DIRECT_ACCEPT_TIMEOUT);
+    });
+}
+
+void peer_manager::discard_connection(friend_id_type friend_id)
+{
+    strand.post([self = shared_from_this(), friend_id]
+    {
+        auto it = self->peers.find(friend_id);
+        if (it == self->peers.end() || it->second.state != peer_state::WANTED)
+        {
+            return;
+        }
+        self->peers.erase(it);
+        self->con->post_request(make_unique<friend_request>(
+                                    opcode::DISCARD_CONNECTION, friend_id));
+    });
+}
+
+void peer_manager::close_client_connection(friend_id_type friend_id)
+{
+    strand.post([self = shared_from_this(), friend_id]
+    {
+        auto it = self->peers.find(friend_id);
+        if (it == self->peers.end())
+        {
+            return;
+        }
+
+        peer &p = it->second;
+        if (p.timer)
+        {
+            p.timer->cancel();
+        }
+        if (p.link)
+        {
+            self->link_owners.erase(p.link.get());
+            p.link->send(opcode::PEER_BYE, 0);
+            p.link->close_when_sent();
+        }
+        bool was_connected = p.connected;
+        self->flush_delivered(friend_id, p, true);
+        self->peers.erase(it);
+        self->con->post_request(make_unique<friend_request>(
+                                    opcode::CLOSE_CLIENT_CONNECTION,
+                                    friend_id));
+        if (was_connected)
+        {
+            self->emit(make_event<friend_disconnected_event>(friend_id));
+        }
+    });
+}
+
+void peer_manager::endpoint_received(friend_id_type friend_id,
+                                     const peer_endpoint &endpoint)
+{
+    strand.post([self = shared_from_this(), friend_id, endpoint]
+    {
+        auto it = self->peers.find(friend_id);
+        if (it == self->peers.end() ||
+            it->second.state != peer_state::REQUESTED)
+        {
+            return;
+        }
+
+        peer &p = it->second;
+        boost_error ec;
+        auto address = ip::address::from_string(endpoint.address, ec);
+        if (ec || endpoint.port == 0)
+        {
+            self->go_relay(friend_id, p);
+            return;
+        }
+
+        p.state = peer_state::CONNECTING;
+        p.token = endpoint.token;
+        self->start_timer(friend_id, p, DIRECT_CONNECT_TIMEOUT);
+        if (endpoint.datagram)
+        {
+            self->connect_datagram(friend_id, p,
+                                   udp::endpoint{address, endpoint.port});
+        }
+        else
+        {
+            self->connect_stream(friend_id, p,
+                                 tcp::endpoint{address, endpoint.port});
+        }
+    });
+}
+
+void peer_manager::set_datagram_transport(bool enabled)
+{
+    strand.post([self = shared_from_this(), enabled]
+    {
+        self->datagram = enabled;
+    });
+}
+
+void peer_manager::set_datagram_loss(double probability)
+{
+    strand.post([self = shared_from_this(), probability]
+    {
+        self->datagram_loss = probability;
+    });
+}
+
+void peer_manager::set_range_events(bool enabled)
+{
+    strand.post([self = shared_from_this(), enabled]
+    {
+        self->range_events = enabled;
+    });
+}
+
+void peer_manager::set_outbox(shared_ptr<outbox> new_box)
+{
+    strand.post([self = shared_from_this(), new_box = move(new_box)]() mutable
+    {
+        self->box = move(new_box);
+    });
+}
+
+void peer_manager::resend_outbox()
+{
+    strand.post([self = shared_from_this()]
+    {
+        if (!self->box)
+        {
+            return;
+        }
+        for (auto &m : self->box->pending())
+        {
+            self->resend(m.friend_id, m.message_id, move(m.text));
+        }
+    });
+}
+
+void peer_manager::connect_stream(friend_id_type friend_id, peer &p,
+                                  const tcp::endpoint &endpoint)
+{
+    auto link = tcp_peer_link::create(service, strand);
+    p.link = link;
+    link_owners[link.get()] = friend_id;
+    link->socket().async_connect(endpoint, strand.wrap(
+                                 [self = shared_from_this(), link]
+                                 (boost_error ec)
+                                 {
+                                     auto owner =
+                                             self->link_owners.find(link.get());
+                                     if (ec == error::operation_aborted ||
+                                         owner == self->link_owners.end())
+                                     {
+                                         return;
+                                     }
+
+                                     peer &p = self->peers.at(owner->second);
+                                     if (ec)
+                                     {
+                                         self->go_relay(owner->second, p);
+                                         return;
+                                     }
+                                     self->start_link(link);
+                                     link->send(opcode::PEER_HELLO, p.token);
+                                 }));
+}
+
+void peer_manager::connect_datagram(friend_id_type friend_id, peer &p,
+                                    const udp::endpoint &endpoint)
+{
+    auto link = udp_peer_link::create(service, strand);
+    auto any = endpoint.address().is_v4() ? ip::address{ip::address_v4::any()}
+                                          : ip::address{ip::address_v6::any()};
+    if (!link->bind(any))
+    {
+        go_relay(friend_id, p);
+        return;
+    }
+
+    link->set_loss(datagram_loss);
+    link->set_remote(endpoint);
+    p.link = link;
+    link_owners[link.get()] = friend_id;
+    start_link(link);
+    link->send(opcode::PEER_HELLO, p.token);
+}
+
+bool peer_manager::listen_datagram(friend_id_type friend_id, peer &p)
+{
+    boost_error ec;
+    auto address = ip::address::from_string(con->local_address(), ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    auto link = udp_peer_link::create(service, strand);
+    if (!link->bind(address))
+    {
+        return false;
+    }
+
+    link->set_loss(datagram_loss);
+    p.state = peer_state::LISTENING;
+    p.token = random() | 1;
+    p.link = link;
+    link_owners[link.get()] = friend_id;
+    start_link(link);
+    con->post_request(make_unique<confirm_connection_request>(
+                          friend_id, address.to_string(), link->local_port(),
+                          p.token, true));
+    return true;
+}
+
+bool peer_manager::observe(const event::ptr &e)
+{
+    auto code = e->code();
+    if (code == events_code::DISCONNECTED)
+    {
+        close_all();
+        return false;
+    }
+    if (code == events_code::RECONNECTED)
+    {
+        resend_outbox();
+        return false;
+    }
+    if (code == events_code::FRIEND_NEW_MESSAGE)
+    {
+        auto &m = static_cast<const friend_new_message_event&>(*e);
+        return duplicate(m.friend_id(), m.message_id());
+    }
+    if (code == events_code::FRIEND_MESSAGE_DELIVERED)
+    {
+        auto &d = static_cast<const friend_message_delivered_event&>(*e);
+        strand.post([self = shared_from_this(), friend_id = d.friend_id(),
+                    first = d.first_message_id(), message_id = d.message_id()]
+        {
+            if (first == 0)
+            {
+                self->delivered_up_to(friend_id, message_id, route::RELAY);
+            }
+            else
+            {
+                self->delivered(friend_id, message_id, route::RELAY);
+            }
+        });
+        return true;
+    }
+    if (code == events_code::FRIEND_MESSAGE_READED)
+    {
+        auto &r = static_cast<const friend_message_readed_event&>(*e);
+        strand.post([self = shared_from_this(), friend_id = r.friend_id(),
+                    first = r.first_message_id(), message_id = r.message_id()]
+        {
+            self->readed(friend_id, first, message_id);
+        });
+        return true;
+    }
+    if (code != events_code::FRIEND_WANTED_TO_CONNECT &&
+        code != events_code::FRIEND_WANTED_TO_STOP_CONNECTION &&
+        code != events_code::FRIEND_CONFIRMED_CONNECTION &&
+        code != events_code::FRIEND_DISCARDED_CONNECTION &&
+        code != events_code::FRIEND_DISCONNECTED)
+    {
+        return false;
+    }
+
+    auto friend_id = static_cast<const friend_event&>(*e).friend_id();
+    strand.post([self = shared_from_this(), code, friend_id]
+    {
+        auto it = self->peers.find(friend_id);
+        switch (code)
+        {
+        case events_code::FRIEND_WANTED_TO_CONNECT:
+            if (it == self->peers.end())
+            {
+                self->peers[friend_id].state = peer_state::WANTED;
+            }
+            break;
+        case events_code::FRIEND_CONFIRMED_CONNECTION:
+            if (it != self->peers.end() &&
+                it->second.state == peer_state::REQUESTED)
+            {
+                it->second.state = peer_state::RELAY;
+            }
+            break;
+        default:
+            self->forget(friend_id);
+            break;
+        }
+    });
+    return false;
+}
+
+void peer_manager::close_all()
+{
+    strand.dispatch([self = shared_from_this()]
+    {
+        for (auto &item : self->peers)
+        {
+            if (item.second.timer)
+            {
+                item.second.timer->cancel();
+            }
+            if (item.second.link)
+            {
+                item.second.link->send(opcode::PEER_BYE, 0);
+                item.second.link->close_when_sent();
+            }
+        }
+        for (auto &item : self->accepted_links)
+        {
+            item.second->close();
+        }
+        self->peers.clear();
+        self->link_owners.clear();
+        self->accepted_links.clear();
+
+        boost_error ec;
+        self->acceptor.close(ec);
+        self->probe_timer.cancel(ec);
+        self->probing = false;
+    });
+}
+
+void peer_manager::send_message(friend_id_type friend_id,
+                                message_id_type message_id,
+                                message_buffer message)
+{
+    strand.post([self = shared_from_this(), friend_id, message_id,
+                message = move(message)]() mutable
+    {
+        self->enqueue(friend_id, message_id, move(message));
+    });
+}
+
+void peer_manager::confirm_reading(friend_id_type friend_id,
+                                   message_id_type message_id, bool up_to)
+{
+    strand.post([self = shared_from_this(), friend_id, message_id, up_to]
+    {
+        auto it = self->peers.find(friend_id);
+        if (it != self->peers.end() &&
+            it->second.state == peer_state::DIRECT &&
+            it->second.current == route::DIRECT)
+        {
+            it->second.link->send(up_to ? opcode::PEER_READED_UP_TO
+                                        : opcode::PEER_READED, message_id);
+            return;
+        }
+        self->con->post_request(make_unique<confirm_reading_request>(
+                                    friend_id, message_id, up_to));
+    });
+}
+
+bool peer_manager::start_listening()
+{
+    if (acceptor.is_open())
+    {
+        return true;
+    }
+
+    boost_error ec;
+    auto address = ip::address::from_string(con->local_address(), ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    tcp::endpoint endpoint{address, 0};
+    acceptor.open(endpoint.protocol(), ec);
+    if (!ec)
+    {
+        acceptor.bind(endpoint, ec);
+    }
+    if (!ec)
+    {
+        acceptor.listen(socket_base::max_listen_connections, ec);
+    }
+    if (ec)
+    {
+        acceptor.close(ec);
+        return false;
+    }
+
+    start_accept();
+    return true;
+}
+
+void peer_manager::start_accept()
+{
+    auto link = tcp_peer_link::create(service, strand);
+    acceptor.async_accept(link->socket(), strand.wrap(
+                          [self = shared_from_this(), link](boost_error ec)
+                          {
+                              if (ec == error::operation_aborted ||
+                                  !self->acceptor.is_open())
+                              {
+                                  return;
+                              }
+                              if (!ec && self->accepted_links.size() <
+                                         MAX_PENDING_LINKS)
+                              {
+                                  self->accepted_links[link.get()] = link;
+                                  self->start_link(link);
+                              }
+                              self->start_accept();
+                          }));
+}
+
+void peer_manager::start_link(const peer_link::ptr &link)
+{
+    auto self = shared_from_this();
+    link->start([self, l = link.get()](const peer_link::frame &f)
+                {
+                    self->link_frame(l, f);
+                },
+                [self, l = link.get()]
+                {
+                    self->link_closed(l);
+                });
+}
+
+void peer_manager::start_timer(friend_id_type friend_id, peer &p,
+                               boost::posix_time::time_duration timeout)
+{
+    if (p.timer)
+    {
+        p.timer->cancel();
+    }
+    p.timer = make_shared<deadline_timer>(service, timeout);
+    p.timer->async_wait(strand.wrap(
+                        [self = shared_from_this(), friend_id,
+                        timer = p.timer](boost_error ec)
+                        {
+                            auto it = self->peers.find(friend_id);
+                            if (ec == error::operation_aborted ||
+                                it == self->peers.end() ||
+                                it->second.timer != timer)
+                            {
+                                return;
+                            }
+
+                            it->second.timer.reset();
+                            if (it->second.state == peer_state::LISTENING ||
+                                it->second.state == peer_state::CONNECTING)
+                            {
+                                self->go_relay(friend_id, it->second);
+                            }
+                        }));
+}
+
+void peer_manager::link_frame(peer_link *link, const peer_link::frame &f)
+{
+    if (accepted_links.count(link))
+    {
+        if (f.command == opcode::PEER_HELLO)
+        {
+            accept_hello(link, f.value);
+        }
+        else
+        {
+            accepted_links[link]->close();
+            accepted_links.erase(link);
+        }
+        return;
+    }
+
+    auto owner = link_owners.find(link);
+    if (owner == link_owners.end())
+    {
+        return;
+    }
+
+    friend_id_type friend_id = owner->second;
+    peer &p = peers.at(friend_id);
+    if (p.ack_up_to != 0)
+    {
+        post_delivered_ack(friend_id, p);
+    }
+    switch (f.command)
+    {
+    case opcode::PEER_HELLO:
+        if (p.state == peer_state::LISTENING && f.value == p.token)
+        {
+            p.link->send(opcode::PEER_HELLO, p.token);
+            go_direct(friend_id, p, p.link);
+        }
+        else if (p.state == peer_state::CONNECTING && f.value == p.token)
+        {
+            go_direct(friend_id, p, p.link);
+        }
+        break;
+    case opcode::PEER_MESSAGE:
+        if (f.body)
+        {
+            if (!duplicate(friend_id, f.value))
+            {
+                emit(make_event<friend_new_message_event>(friend_id, f.body,
+                                                          f.value));
+            }
+            p.ack_up_to = max(p.ack_up_to, f.value);
+            post_delivered_ack(friend_id, p);
+        }
+        break;
+    case opcode::PEER_DELIVERED:
+        delivered(friend_id, f.value, route::DIRECT);
+        break;
+    case opcode::PEER_DELIVERED_UP_TO:
+        delivered_up_to(friend_id, f.value, route::DIRECT);
+        break;
+    case opcode::PEER_READED:
+        readed(friend_id, f.value, f.value);
+        break;
+    case opcode::PEER_READED_UP_TO:
+        readed(friend_id, 0, f.value);
+        break;
+    case opcode::PEER_PING:
+        p.link->send(opcode::PEER_PONG, f.value);
+        break;
+    case opcode::PEER_PONG:
+        if (p.probe != 0 && f.value == p.probe)
+        {
+            p.direct.rtt.add_sample(duration_cast<microseconds>(
+                                        steady_clock::now() - p.probe_sent));
+            p.direct.add_sample(false);
+            p.probe = 0;
+            choose_route(p);
+        }
+        break;
+    case opcode::PEER_BYE:
+        detach_link(p);
+        if (p.timer)
+        {
+            p.timer->cancel();
+        }
+        flush_delivered(friend_id, p, true);
+        peers.erase(friend_id);
+        break;
+    default:
+        detach_link(p);
+        go_relay(friend_id, p);
+        break;
+    }
+}
+
+void peer_manager::link_closed(peer_link *link)
+{
+    if (accepted_links.erase(link))
+    {
+        return;
+    }
+
+    auto owner = link_owners.find(link);
+    if (owner == link_owners.end())
+    {
+        return;
+    }
+
+    friend_id_type friend_id = owner->second;
+    peer &p = peers.at(friend_id);
+    detach_link(p);
+    if (p.state == peer_state::DIRECT || p.state == peer_state::CONNECTING ||
+        p.state == peer_state::LISTENING)
+    {
+        go_relay(friend_id, p);
+    }
+}
+
+void peer_manager::accept_hello(peer_link *link, uint64_t token)
+{
+    auto accepted = accepted_links.find(link);
+    peer_link::ptr l = move(accepted->second);
+    accepted_links.erase(accepted);
+
+    for (auto &item : peers)
+    {
+        peer &p = item.second;
+        if (p.token == token && !p.link &&
+            (p.state == peer_state::LISTENING || p.state == peer_state::RELAY))
+        {
+            l->send(opcode::PEER_HELLO, token);
+            go_direct(item.first, p, move(l));
+            return;
+        }
+    }
+    l->close();
+}
+
+void peer_manager::go_direct(friend_id_type friend_id, peer &p,
+                             peer_link::ptr link)
+{
+    if (p.timer)
+    {
+        p.timer->cancel();
+        p.timer.reset();
+    }
+    link_owners[link.get()] = friend_id;
+    p.link = move(link);
+    p.state = peer_state::DIRECT;
+    p.current = route::DIRECT;
+    p.direct.rtt.reset();
+    p.direct.loss = 0;
+    send_probe(p);
+    start_probing();
+    report_connected(friend_id, p);
+}
+
+void peer_manager::go_relay(friend_id_type friend_id, peer &p)
+{
+    if (p.timer)
+    {
+        p.timer->cancel();
+        p.timer.reset();
+    }
+    detach_link(p);
+    p.state = peer_state::RELAY;
+    p.current = route::RELAY;
+    p.probe = 0;
+    for (auto &message : p.sent)
+    {
+        if (!message.delivered && message.via == route::DIRECT)
+        {
+            message.via = route::RELAY;
+            send_via(friend_id, message);
+        }
+    }
+    report_connected(friend_id, p);
+}
+
+void peer_manager::detach_link(peer &p)
+{
+    p.ack_up_to = 0;
+    if (p.link)
+    {
+        link_owners.erase(p.link.get());
+        p.link->close();
+        p.link.reset();
+    }
+}
+
+void peer_manager::forget(friend_id_type friend_id)
+{
+    auto it = peers.find(friend_id);
+    if (it == peers.end())
+    {
+        return;
+    }
+    if (it->second.timer)
+    {
+        it->second.timer->cancel();
+    }
+    detach_link(it->second);
+    flush_delivered(friend_id, it->second, true);
+    peers.erase(it);
+}
+
+void peer_manager::start_probing()
+{
+    if (probing)
+    {
+        return;
+    }
+
+    probing = true;
+    probe_timer.expires_from_now(PROBE_INTERVAL);
+    probe_timer.async_wait(strand.wrap(
+                           [self = shared_from_this()](boost_error ec)
+                           {
+                               if (ec == error::operation_aborted ||
+                                   !self->probing)
+                               {
+                                   return;
+                               }
+                               self->probe_paths();
+                           }));
+}
+
+void peer_manager::probe_paths()
+{
+    probing = false;
+    auto now = steady_clock::now();
+    bool any_direct = false;
+    for (auto &item : peers)
+    {
+        peer &p = item.second;
+        if (p.state != peer_state::DIRECT)
+        {
+            continue;
+        }
+
+        any_direct = true;
+        if (p.probe != 0)
+        {
+            p.direct.add_sample(true);
+        }
+
+        auto timeout = p.relay.rtt.rto(std::chrono::milliseconds{1},
+                                       RELAY_LOSS_TIMEOUT_MIN,
+                                       RELAY_LOSS_TIMEOUT_MAX,
+                                       RELAY_LOSS_TIMEOUT_MIN);
+        for (auto &message : p.sent)
+        {
+            if (message.via == route::RELAY && !message.delivered &&
+                !message.lost && now - message.sent > timeout)
+            {
+                message.lost = true;
+                p.relay.add_sample(true);
+            }
+        }
+
+        send_probe(p);
+        choose_route(p);
+    }
+
+    if (any_direct)
+    {
+        start_probing();
+    }
+}
+
+void peer_manager::send_probe(peer &p)
+{
+    p.probe = random() | 1;
+    p.probe_sent = steady_clock::now();
+    p.link->send(opcode::PEER_PING, p.probe);
+}
+
+void peer_manager::choose_route(peer &p)
+{
+    if (p.state != peer_state::DIRECT)
+    {
+        p.current = route::RELAY;
+        return;
+    }
+
+    auto direct = p.direct.cost();
+    auto relay = p.relay.cost();
+    if (relay.count() == 0)
+    {
+        relay = 2 * con->rtt();
+    }
+    if (direct.count() == 0 || relay.count() == 0)
+    {
+        return;
+    }
+
+    if (p.current == route::DIRECT &&
+        relay.count() * 100 < direct.count() * SWITCH_MARGIN_PERCENT)
+    {
+        p.current = route::RELAY;
+    }
+    else if (p.current == route::RELAY &&
+             direct.count() * 100 < relay.count() * SWITCH_MARGIN_PERCENT)
+    {
+        p.current = route::DIRECT;
+    }
+}
+
+void peer_manager::enqueue(friend_id_type friend_id,
+                           message_id_type message_id, message_buffer message)
+{
+    receipts &r = friend_receipts[friend_id];
+    if (r.read_up_to == 0)
+    {
+        r.read_up_to = message_id - 1;
+    }
+
+    auto it = peers.find(friend_id);
+    if (it == peers.end())
+    {
+        remember(r.relayed, message_id);
+        con->post_request(make_unique<send_message_request>(
+                              friend_id, message_id, move(message)));
+        return;
+    }
+
+    peer &p = it->second;
+    route via = p.state == peer_state::DIRECT ? p.current : route::RELAY;
+    auto pos = p.sent.end();
+    while (pos != p.sent.begin() && prev(pos)->id > message_id)
+    {
+        --pos;
+    }
+    pos = p.sent.insert(pos, outgoing{message_id, move(message), {}, via});
+    send_via(friend_id, *pos);
+}
+
+void peer_manager::resend(friend_id_type friend_id,
+                          message_id_type message_id, message_buffer message)
+{
+    auto &relayed = friend_receipts[friend_id].relayed;
+    if (find(relayed.begin(), relayed.end(), message_id) != relayed.end())
+    {
+        con->post_request(make_unique<send_message_request>(
+                              friend_id, message_id, move(message)));
+        return;
+    }
+
+    auto it = peers.find(friend_id);
+    if (it != peers.end())
+    {
+        peer &p = it->second;
+        auto sent = find_if(p.sent.begin(), p.sent.end(),
+                            [message_id](const outgoing &m)
+                            {
+                                return m.id == message_id;
+                            });
+        if (sent != p.sent.end())
+        {
+            if (!sent->delivered && (sent->via == route::RELAY ||
+                                     p.state != peer_state::DIRECT))
+            {
+                sent->via = route::RELAY;
+                send_via(friend_id, *sent);
+            }
+            return;
+        }
+    }
+    enqueue(friend_id, message_id, move(message));
+}
+
+bool peer_manager::duplicate(friend_id_type friend_id,
+                             message_id_type message_id)
+{
+    if (message_id == 0)
+    {
+        return false;
+    }
+
+    lock_guard<mutex> lck(seen_mutex);
+    seen_messages &s = seen[friend_id];
+    if (message_id <= s.floor || !s.ids.insert(message_id).second)
+    {
+        return true;
+    }
+    if (s.ids.size() > MAX_SEEN_MESSAGES)
+    {
+        s.floor = *s.ids.begin();
+        s.ids.erase(s.ids.begin());
+    }
+    return false;
+}
+
+void peer_manager::send_via(friend_id_type friend_id, outgoing &message)
+{
+    message.sent = steady_clock::now();
+    message.lost = false;
+    if (message.via == route::DIRECT)
+    {
+        peers.at(friend_id).link->send(opcode::PEER_MESSAGE, message.id,
+                                       message.message);
+        return;
+    }
+    con->post_request(make_unique<send_message_request>(
+                          friend_id, message.id, message.message));
+}
+
+void peer_manager::post_delivered_ack(friend_id_type friend_id, peer &p)
+{
+    if (p.ack_posted)
+    {
+        return;
+    }
+
+    p.ack_posted = true;
+    strand.post([self = shared_from_this(), friend_id]
+    {
+        self->send_delivered_ack(friend_id);
+    });
+}
+
+void peer_manager::send_delivered_ack(friend_id_type friend_id)
+{
+    auto it = peers.find(friend_id);
+    if (it == peers.end())
+    {
+        return;
+    }
+
+    peer &p = it->second;
+    p.ack_posted = false;
+    if (p.ack_up_to == 0 || !p.link || p.link->has_gaps())
+    {
+        return;
+    }
+    p.link->send(opcode::PEER_DELIVERED_UP_TO, p.ack_up_to);
+    p.ack_up_to = 0;
+}
+
+void peer_manager::delivered(friend_id_type friend_id,
+                             message_id_type message_id, route via)
+{
+    auto it = peers.find(friend_id);
+    if (it != peers.end())
+    {
+        peer &p = it->second;
+        auto message = find_if(p.sent.begin(), p.sent.end(),
+                               [message_id](const outgoing &m)
+                               {
+                                   return m.id == message_id;
+                               });
+        if (message != p.sent.end())
+        {
+            if (message->delivered)
+            {
+                return;
+            }
+
+            if (message->via == via)
+            {
+                path &measured = via == route::DIRECT ? p.direct : p.relay;
+                measured.rtt.add_sample(duration_cast<microseconds>(
+                                            steady_clock::now() -
+                                            message->sent));
+                if (!message->lost)
+                {
+                    measured.add_sample(false);
+                }
+            }
+            message->delivered = true;
+            flush_delivered(friend_id, p);
+            choose_route(p);
+            return;
+        }
+    }
+
+    auto &relayed = friend_receipts[friend_id].relayed;
+    auto message = find(relayed.begin(), relayed.end(), message_id);
+    if (message != relayed.end())
+    {
+        relayed.erase(message);
+    }
+    report_delivered(friend_id, message_id, message_id);
+}
+
+void peer_manager::delivered_up_to(friend_id_type friend_id,
+                                   message_id_type message_id, route via)
+{
+    if (via == route::RELAY)
+    {
+        flush_relayed(friend_id, message_id);
+    }
+
+    auto it = peers.find(friend_id);
+    if (it == peers.end())
+    {
+        return;
+    }
+
+    peer &p = it->second;
+    path &measured = via == route::DIRECT ? p.direct : p.relay;
+    outgoing *newest = nullptr;
+    for (auto &message : p.sent)
+    {
+        if (message.id > message_id)
+        {
+            break;
+        }
+        if (message.delivered || message.via != via)
+        {
+            continue;
+        }
+        if (!message.lost)
+        {
+            measured.add_sample(false);
+        }
+        message.delivered = true;
+        newest = &message;
+    }
+    if (!newest)
+    {
+        return;
+    }
+
+    measured.rtt.add_sample(duration_cast<microseconds>(steady_clock::now() -
+                                                        newest->sent));
+    flush_delivered(friend_id, p);
+    choose_route(p);
+}
+
+void peer_manager::flush_delivered(friend_id_type friend_id, peer &p, bool all)
+{
+    message_id_type first = 0;
+    message_id_type last = 0;
+    while (!p.sent.empty() && (p.sent.front().delivered || all))
+    {
+        bool was_delivered = p.sent.front().delivered;
+        bool relayed = p.sent.front().via == route::RELAY;
+        message_id_type message_id = p.sent.front().id;
+        p.sent.pop_front();
+        if (!was_delivered)
+        {
+            report_delivered(friend_id, first, last);
+            first = 0;
+            if (relayed)
+            {
+                remember(friend_receipts[friend_id].relayed, message_id);
+            }
+            continue;
+        }
+        if (first == 0 || !range_events)
+        {
+            report_delivered(friend_id, first, last);
+            first = message_id;
+        }
+        last = message_id;
+    }
+    report_delivered(friend_id, first, last);
+}
+
+void peer_manager::flush_relayed(friend_id_type friend_id,
+                                 message_id_type message_id)
+{
+    auto &relayed = friend_receipts[friend_id].relayed;
+    message_id_type first = 0;
+    message_id_type last = 0;
+    while (!relayed.empty() && relayed.front() <= message_id)
+    {
+        if (first == 0 || !range_events)
+        {
+            report_delivered(friend_id, first, last);
+            first = relayed.front();
+        }
+        last = relayed.front();
+        relayed.pop_front();
+    }
+    report_delivered(friend_id, first, last);
+}
+
+void peer_manager::report_delivered(friend_id_type friend_id,
+                                    message_id_type first,
+                                    message_id_type last)
+{
+    if (first == 0)
+    {
+        return;
+    }
+    if (box)
+    {
+        box->remove(friend_id, first, last);
+    }
+    if (!range_events)
+    {
+        remember(friend_receipts[friend_id].unread, last);
+    }
+    emit(make_event<friend_message_delivered_event>(friend_id, first, last));
+}
+
+void peer_manager::readed(friend_id_type friend_id, message_id_type first,
+                          message_id_type last)
+{
+    delivered_by_reading(friend_id, first, last);
+
+    receipts &r = friend_receipts[friend_id];
+    bool up_to = first == 0;
+    if (up_to)
+    {
+        if (last <= r.read_up_to)
+        {
+            return;
+        }
+        first = r.read_up_to + 1;
+        r.read_up_to = last;
+    }
+
+    if (range_events)
+    {
+        emit(make_event<friend_message_readed_event>(friend_id, first, last));
+        return;
+    }
+
+    if (!up_to)
+    {
+        auto message = find(r.unread.begin(), r.unread.end(), last);
+        if (message != r.unread.end())
+        {
+            r.unread.erase(message);
+        }
+        emit(make_event<friend_message_readed_event>(friend_id, last));
+        return;
+    }
+
+    while (!r.unread.empty() && r.unread.front() <= last)
+    {
+        emit(make_event<friend_message_readed_event>(friend_id,
+                                                     r.unread.front()));
+        r.unread.pop_front();
+    }
+}
+
+void peer_manager::delivered_by_reading(friend_id_type friend_id,
+                                        message_id_type first,
+                                        message_id_type last)
+{
+    auto it = peers.find(friend_id);
+    if (it != peers.end())
+    {
+        for (auto &message : it->second.sent)
+        {
+            if (message.id > last)
+            {
+                break;
+            }
+            if (first == 0 || message.id == last)
+            {
+                message.delivered = true;
+            }
+        }
+        flush_delivered(friend_id, it->second);
+    }
+
+    if (first == 0)
+    {
+        flush_relayed(friend_id, last);
+        return;
+    }
+    auto &relayed = friend_receipts[friend_id].relayed;
+    auto message = find(relayed.begin(), relayed.end(), last);
+    if (message != relayed.end())
+    {
+        relayed.erase(message);
+        report_delivered(friend_id, last, last);
+    }
+}
+
+void peer_manager::report_connected(friend_id_type friend_id, peer &p)
+{
+    if (!p.connected)
+    {
+        p.connected = true;
+        emit(make_event<friend_connected_event>(friend_id));
+    }
+}
+
+void peer_manager::emit(event::ptr e)
+{
+    if (on_event)
+    {
+        on_event(move(e));
+    }
+}
+
+}
@@ -0,0 +1,181 @@
+#ifndef P2P_PEER_MANAGER_H
+#define P2P_PEER_MANAGER_H
+
+#include <cstdint>
+#include <memory>
+#include <deque>
+#include <utility>
+#include <unordered_map>
+#include <set>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include <boost/asio.hpp>
+
+#include "p2p_common.h"
+#include "p2p_events.h"
+#include "p2p_connection.h"
+#include "p2p_notifications.h"
+#include "p2p_peer_link.h"
+#include "p2p_udp_peer_link.h"
+#include "p2p_rtt_estimator.h"
+#include "p2p_outbox.h"
+
+namespace p2p
+{
+
+class peer_manager : public std::enable_shared_from_this<peer_manager>
+{
+    peer_manager(boost::asio::io_service &service, connection::ptr con);
+
+public:
+    using ptr = std::shared_ptr<peer_manager>;
+    static ptr create(boost::asio::io_service &service, connection::ptr con);
+
+    void set_event_handler(connection::event_handler handler);
+
+    void connect_to_client(friend_id_type friend_id);
+    void confirm_connection(friend_id_type friend_id);
+    void discard_connection(friend_id_type friend_id);
+    void close_client_connection(friend_id_type friend_id);
+    void endpoint_received(friend_id_type friend_id,
+                           const peer_endpoint &endpoint);
+    bool observe(const event::ptr &e);
+    void close_all();
+
+    void set_datagram_transport(bool enabled);
+    void set_datagram_loss(double probability);
+    void set_range_events(bool enabled);
+    void set_outbox(std::shared_ptr<outbox> box);
+    void resend_outbox();
+
+    void send_message(friend_id_type friend_id, message_id_type message_id,
+                      message_buffer message);
+    void confirm_reading(friend_id_type friend_id, message_id_type message_id,
+                         bool up_to = false);
+
+private:
+    boost::asio::io_service &service;
+    boost::asio::io_service::strand strand;
+    connection::ptr con;
+    connection::event_handler on_event;
+    boost::asio::ip::tcp::acceptor acceptor;
+    boost::asio::deadline_timer probe_timer;
+    bool datagram = true;
+    double datagram_loss = 0;
+    bool range_events = false;
+    std::shared_ptr<outbox> box;
+    bool probing = false;
+    std::mt19937_64 random;
+
+    enum class peer_state
+    {
+        REQUESTED,
+        WANTED,
+        LISTENING,
+        CONNECTING,
+        DIRECT,
+        RELAY
+    };
+    enum class route { DIRECT, RELAY };
+    struct path
+    {
+        rtt_estimator rtt;
+        double loss = 0;
+
+        void add_sample(bool lost);
+        std::chrono::microseconds cost() const;
+    };
+    struct outgoing
+    {
+        message_id_type id;
+        message_buffer message;
+        std::chrono::steady_clock::time_point sent;
+        route via;
+        bool delivered = false;
+        bool lost = false;
+    };
+    struct peer
+    {
+        peer_state state = peer_state::REQUESTED;
+        peer_link::ptr link;
+        uint64_t token = 0;
+        std::shared_ptr<boost::asio::deadline_timer> timer;
+        std::deque<outgoing> sent;
+        bool connected = false;
+
+        route current = route::RELAY;
+        path direct;
+        path relay;
+        uint64_t probe = 0;
+        std::chrono::steady_clock::time_point probe_sent;
+
+        message_id_type ack_up_to = 0;
+        bool ack_posted = false;
+    };
+    struct receipts
+    {
+        std::deque<message_id_type> relayed;
+        std::deque<message_id_type> unread;
+        message_id_type read_up_to = 0;
+    };
+    std::unordered_map<friend_id_type, peer> peers;
+    std::unordered_map<friend_id_type, receipts> friend_receipts;
+    struct seen_messages
+    {
+        std::set<message_id_type> ids;
+        message_id_type floor = 0;
+    };
+    std::unordered_map<friend_id_type, seen_messages> seen;
+    std::mutex seen_mutex;
+    std::unordered_map<peer_link*, friend_id_type> link_owners;
+    std::unordered_map<peer_link*, peer_link::ptr> accepted_links;
+
+    bool start_listening();
+    bool listen_datagram(friend_id_type friend_id, peer &p);
+    void connect_stream(friend_id_type friend_id, peer &p,
+                        const boost::asio::ip::tcp::endpoint &endpoint);
+    void connect_datagram(friend_id_type friend_id, peer &p,
+                          const boost::asio::ip::udp::endpoint &endpoint);
+    void start_accept();
+    void start_link(const peer_link::ptr &link);
+    void start_timer(friend_id_type friend_id, peer &p,
+                     boost::posix_time::time_duration timeout);
+    void start_probing();
+    void probe_paths();
+    void send_probe(peer &p);
+    void enqueue(friend_id_type friend_id, message_id_type message_id,
+                 message_buffer message);
+    void resend(friend_id_type friend_id, message_id_type message_id,
+                message_buffer message);
+    bool duplicate(friend_id_type friend_id, message_id_type message_id);
+    void choose_route(peer &p);
+    void send_via(friend_id_type friend_id, outgoing &message);
+    void post_delivered_ack(friend_id_type friend_id, peer &p);
+    void send_delivered_ack(friend_id_type friend_id);
+    void delivered(friend_id_type friend_id, message_id_type message_id,
+                   route via);
+    void delivered_up_to(friend_id_type friend_id, message_id_type message_id,
+                         route via);
+    void flush_delivered(friend_id_type friend_id, peer &p, bool all = false);
+    void flush_relayed(friend_id_type friend_id, message_id_type message_id);
+    void report_delivered(friend_id_type friend_id, message_id_type first,
+                          message_id_type last);
+    void readed(friend_id_type friend_id, message_id_type first,
+                message_id_type last);
+    void delivered_by_reading(friend_id_type friend_id, message_id_type first,
+                              message_id_type last);
+    void link_frame(peer_link *link, const peer_link::frame &f);
+    void link_closed(peer_link *link);
+    void accept_hello(peer_link *link, uint64_t token);
+    void go_direct(friend_id_type friend_id, peer &p, peer_link::ptr link);
+    void go_relay(friend_id_type friend_id, peer &p);
+    void detach_link(peer &p);
+    void forget(friend_id_type friend_id);
+    void report_connected(friend_id_type friend_id, peer &p);
+    void emit(event::ptr e);
+};
+
+}
+
+#endif // P2P_PEER_MANAGER_H
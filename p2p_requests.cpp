@@ -3,52 +3,88 @@
 #include <cstdint>
 #include <cstddef>
 #include <memory>
-#include <set>
-#include <unordered_set>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <initializer_list>
 
 #include <p2p_common.h>
+#include "p2p_codec.h"
 
 using namespace std;
 
 namespace p2p {
 
-bool process_account_answer(const buffer_type &buf, size_t buf_size,
-                            string operation,
-                            const unordered_set<string> &valid_answers,
-                            std::shared_ptr<string> result);
+void write_request_header(frame_writer &writer, opcode command,
+                          request_id_type id);
+bool read_answer_header(frame_reader &reader, opcode command,
+                        request_id_type id);
+bool process_account_answer(frame_reader &reader, opcode operation,
+                            request_id_type id,
+                            initializer_list<result_code> valid_answers,
+                            std::shared_ptr<string> result,
+                            std::shared_ptr<string> token = nullptr);
 
 get_version_request::get_version_request(shared_ptr<version_type> version) :
     version{version}
 {
 }
 
-void get_version_request::fill_request(buffer_type &buf, size_t &buf_size)
+get_version_request::get_version_request(shared_ptr<version_type> version,
+                                         string phone, string password,
+                                         shared_ptr<string> autorize_result,
+                                         shared_ptr<string> token) :
+    version{version}, phone{move(phone)}, password{move(password)},
+    autorize_result{autorize_result}, token{token}
 {
-    write_command(buf, buf_size, GET_VERSION);
-    finalize(buf, buf_size);
 }
 
-bool get_version_request::process_answer(const buffer_type &buf,
-                                         size_t buf_size)
+void get_version_request::fill_request(frame_writer &writer)
+{
+    write_request_header(writer, opcode::GET_VERSION, id());
+    writer.append_param(BINARY_ENCODING);
+    if (autorize_result)
+    {
+        writer.append_param(AUTORIZE);
+        writer.append_param(phone);
+        writer.append_param(password);
+    }
+    writer.finalize();
+}
+
+bool get_version_request::process_answer(frame_reader &reader)
 {
-    buf_sequence buf_seq = get_buf_sequence(buf, buf_size);
     try
     {
-        string s = read_string(buf_seq);
-        if (s != GET_VERSION)
+        if (!read_answer_header(reader, opcode::GET_VERSION, id()))
         {
             return false;
         }
 
-        s = read_string(buf_seq);
+        string s = reader.read_string();
         if (!read_version(s))
         {
             return false;
         }
 
-        if (!is_empty(buf_seq))
+        while (!reader.is_empty())
         {
-            return false;
+            string extension = reader.read_string();
+            if (extension == BINARY_ENCODING)
+            {
+                binary_accepted = true;
+            }
+            else if (extension == AUTORIZE && autorize_result)
+            {
+                if (!read_autorize_answer(reader))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                return false;
+            }
         }
 
         return true;
@@ -59,6 +95,34 @@ bool get_version_request::process_answer(const buffer_type &buf,
     }
 }
 
+encoding get_version_request::answer_encoding(encoding current) const
+{
+    return binary_accepted ? encoding::BINARY : current;
+}
+
+bool get_version_request::read_autorize_answer(frame_reader &reader)
+{
+    result_code code = reader.read_result();
+    switch (code)
+    {
+    case result_code::OK:
+    case result_code::INVALID_ACTION:
+    case result_code::INVALID_PHONE:
+    case result_code::INVALID_PASSWORD:
+        break;
+    default:
+        return false;
+    }
+
+    *autorize_result = to_string(code);
+    token->clear();
+    if (code == result_code::OK && !reader.is_empty())
+    {
+        *token = reader.read_string();
+    }
+    return true;
+}
+
 bool get_version_request::read_version(const string &s)
 {
     try
@@ -79,21 +143,21 @@ register_request::register_request(string phone, string password, string code,
 {
 }
 
-void register_request::fill_request(buffer_type &buf, size_t &buf_size)
+void register_request::fill_request(frame_writer &writer)
 {
-    write_command(buf, buf_size, AUTORIZE);
-    append_param(buf, buf_size, phone);
-    append_param(buf, buf_size, password);
-    append_param(buf, buf_size, code);
-    finalize(buf, buf_size);
+    write_request_header(writer, opcode::REGISTER, id());
+    writer.append_param(phone);
+    writer.append_param(password);
+    writer.append_param(code);
+    writer.finalize();
 }
 
-bool register_request::process_answer(const buffer_type &buf, size_t buf_size)
+bool register_request::process_answer(frame_reader &reader)
 {
-    static const unordered_set<string> valid_answers =
-    {"OK", "NEED_CODE", "INVALID_CODE", "ALREADY_EXISTS"};
-
-    return process_account_answer(buf, buf_size, REGISTER, valid_answers,
+    return process_account_answer(reader, opcode::REGISTER, id(),
+                                  {result_code::OK, result_code::NEED_CODE,
+                                   result_code::INVALID_CODE,
+                                   result_code::ALREADY_EXISTS},
                                   result);
 }
 
@@ -103,72 +167,362 @@ unregister_request::unregister_request(string phone, string password,
 {
 }
 
-void unregister_request::fill_request(buffer_type &buf, size_t &buf_size)
+void unregister_request::fill_request(frame_writer &writer)
 {
-    write_command(buf, buf_size, UNREGISTER);
-    append_param(buf, buf_size, phone);
-    append_param(buf, buf_size, password);
-    finalize(buf, buf_size);
+    write_request_header(writer, opcode::UNREGISTER, id());
+    writer.append_param(phone);
+    writer.append_param(password);
+    writer.finalize();
 }
 
-bool unregister_request::process_answer(const buffer_type &buf, size_t buf_size)
+bool unregister_request::process_answer(frame_reader &reader)
 {
-    static const unordered_set<string> valid_answers =
-    {"OK", "INVALID_ACTION", "INVALID_PHONE", "INVALID_PASSWORD"};
-
-    return process_account_answer(buf, buf_size, UNREGISTER, valid_answers,
+    return process_account_answer(reader, opcode::UNREGISTER, id(),
+                                  {result_code::OK, result_code::INVALID_ACTION,
+                                   result_code::INVALID_PHONE,
+                                   result_code::INVALID_PASSWORD},
                                   result);
 }
 
 autorize_request::autorize_request(string phone, string password,
-                                   shared_ptr<string> result) :
-    phone{move(phone)}, password{move(password)}, result{result}
+                                   shared_ptr<string> result,
+                                   shared_ptr<string> token) :
+    phone{move(phone)}, password{move(password)}, result{result},
+    token{token}
 {
 }
 
-void autorize_request::fill_request(buffer_type &buf, size_t &buf_size)
+void autorize_request::fill_request(frame_writer &writer)
 {
-    write_command(buf, buf_size, AUTORIZE);
-    append_param(buf, buf_size, phone);
-    append_param(buf, buf_size, password);
-    finalize(buf, buf_size);
+    write_request_header(writer, opcode::AUTORIZE, id());
+    writer.append_param(phone);
+    writer.append_param(password);
+    writer.finalize();
 }
 
-bool autorize_request::process_answer(const buffer_type &buf, size_t buf_size)
+bool autorize_request::process_answer(frame_reader &reader)
 {
-    static const unordered_set<string> valid_answers =
-    {"OK", "INVALID_ACTION", "INVALID_PHONE", "INVALID_PASSWORD"};
+    return process_account_answer(reader, opcode::AUTORIZE, id(),
+                                  {result_code::OK, result_code::INVALID_ACTION,
+                                   result_code::INVALID_PHONE,
+                                   result_code::INVALID_PASSWORD},
+                                  result, token);
+}
 
-    return process_account_answer(buf, buf_size, AUTORIZE, valid_answers,
-                                  result);
+resume_request::resume_request(string token, shared_ptr<string> result,
+                               shared_ptr<string> new_token) :
+    token{move(token)}, result{result}, new_token{new_token}
+{
+}
+
+void resume_request::fill_request(frame_writer &writer)
+{
+    write_request_header(writer, opcode::RESUME, id());
+    writer.append_param(token);
+    writer.finalize();
+}
+
+bool resume_request::process_answer(frame_reader &reader)
+{
+    return process_account_answer(reader, opcode::RESUME, id(),
+                                  {result_code::OK, result_code::INVALID_ACTION},
+                                  result, new_token);
+}
+
+get_contacts_request::get_contacts_request(
+        phones_list phones, shared_ptr<contacts_dictionary> result) :
+    phones{move(phones)}, result{result}
+{
+}
+
+void get_contacts_request::fill_request(frame_writer &writer)
+{
+    write_request_header(writer, opcode::GET_CONTACTS, id());
+    for (const string &phone : phones)
+    {
+        writer.append_param(phone);
+    }
+    writer.finalize();
+}
+
+bool get_contacts_request::process_answer(frame_reader &reader)
+{
+    try
+    {
+        if (!read_answer_header(reader, opcode::GET_CONTACTS, id()))
+        {
+            return false;
+        }
+
+        contacts_dictionary contacts;
+        contacts.reserve(phones.size());
+        while (!reader.is_empty())
+        {
+            string phone = reader.read_string();
+            contacts[move(phone)] =
+                    static_cast<friend_id_type>(reader.read_uint());
+        }
+
+        *result = move(contacts);
+        return true;
+    }
+    catch (invalid_token_exception&)
+    {
+        return false;
+    }
+}
+
+size_t contacts_batch_end(const get_contacts_request::phones_list &phones,
+                          size_t begin)
+{
+    constexpr size_t HEADER_SIZE = 64;
+    constexpr size_t FRIEND_ID_SIZE = 22;
+    constexpr size_t BATCH_SIZE = sizeof(buffer_type) - HEADER_SIZE;
+
+    size_t end = begin;
+    size_t size = 0;
+    while (end < phones.size())
+    {
+        size += phones[end].size() + FRIEND_ID_SIZE;
+        if (size > BATCH_SIZE && end != begin)
+        {
+            break;
+        }
+        ++end;
+    }
+    return end;
+}
+
+sync_contacts_request::sync_contacts_request(
+        uint64_t version, uint64_t hash, shared_ptr<contacts_delta> result) :
+    version{version}, hash{hash}, result{result}
+{
+}
+
+void sync_contacts_request::fill_request(frame_writer &writer)
+{
+    write_request_header(writer, opcode::SYNC_CONTACTS, id());
+    writer.append_uint(version);
+    writer.append_uint(hash);
+    writer.finalize();
+}
+
+bool sync_contacts_request::process_answer(frame_reader &reader)
+{
+    enum : uint64_t { COMPLETE = 1, RESET = 2 };
+
+    try
+    {
+        if (!read_answer_header(reader, opcode::SYNC_CONTACTS, id()))
+        {
+            return false;
+        }
+
+        contacts_delta delta;
+        delta.version = reader.read_uint();
+        uint64_t flags = reader.read_uint();
+        delta.complete = (flags & COMPLETE) != 0;
+        delta.reset = (flags & RESET) != 0;
+
+        while (!reader.is_empty())
+        {
+            string action = reader.read_string();
+            string phone = reader.read_string();
+            if (action == "+")
+            {
+                delta.changed[move(phone)] =
+                        static_cast<friend_id_type>(reader.read_uint());
+            }
+            else if (action == "-")
+            {
+                delta.removed.push_back(move(phone));
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        *result = move(delta);
+        return true;
+    }
+    catch (invalid_token_exception&)
+    {
+        return false;
+    }
+}
+
+send_message_request::send_message_request(friend_id_type friend_id,
+                                           message_id_type message_id,
+                                           message_buffer message) :
+    friend_id{friend_id}, message_id{message_id}, message{message}
+{
+}
+
+void send_message_request::fill_request(frame_writer &writer)
+{
+    write_request_header(writer, opcode::SEND_MESSAGE, id());
+    writer.append_uint(friend_id);
+    writer.append_uint(message_id);
+    writer.append_uint(message->size());
+    writer.finalize();
+}
+
+bool send_message_request::process_answer(frame_reader&)
+{
+    return false;
+}
+
+boost::asio::const_buffer send_message_request::payload() const
+{
+    return boost::asio::buffer(*message);
+}
+
+friend_request::friend_request(opcode command, friend_id_type friend_id) :
+    command_value{command}, friend_id{friend_id}
+{
+}
+
+void friend_request::fill_request(frame_writer &writer)
+{
+    write_request_header(writer, command_value, id());
+    writer.append_uint(friend_id);
+    fill_params(writer);
+    writer.finalize();
+}
+
+bool friend_request::process_answer(frame_reader&)
+{
+    return false;
+}
+
+confirm_connection_request::confirm_connection_request(
+        friend_id_type friend_id, string address, uint16_t port,
+        uint64_t token, bool datagram) :
+    friend_request{opcode::CONFIRM_CONNECTION, friend_id},
+    address{move(address)}, port{port}, token{token}, datagram{datagram}
+{
+}
+
+void confirm_connection_request::fill_params(frame_writer &writer)
+{
+    writer.append_param(address);
+    writer.append_uint(port);
+    writer.append_uint(token);
+    if (datagram)
+    {
+        writer.append_param(DATAGRAM_TRANSPORT);
+    }
+}
+
+confirm_reading_request::confirm_reading_request(friend_id_type friend_id,
+                                                 message_id_type message_id,
+                                                 bool up_to) :
+    friend_request{opcode::CONFIRM_READING, friend_id}, message_id{message_id},
+    up_to{up_to}
+{
+}
+
+void confirm_reading_request::fill_params(frame_writer &writer)
+{
+    writer.append_uint(message_id);
+    if (up_to)
+    {
+        writer.append_param(CUMULATIVE_ACK);
+    }
+}
+
+void ping_request::fill_request(frame_writer &writer)
+{
+    write_request_header(writer, opcode::PING, id());
+    writer.finalize();
+}
+
+bool ping_request::process_answer(frame_reader &reader)
+{
+    try
+    {
+        return read_answer_header(reader, opcode::PING, id()) &&
+                reader.is_empty();
+    }
+    catch (invalid_token_exception&)
+    {
+        return false;
+    }
+}
+
+bool read_answer_id(frame_reader &reader, request_id_type &id)
+{
+    try
+    {
+        reader.read_command();
+        uint64_t value = reader.read_uint();
+        if (value > numeric_limits<request_id_type>::max())
+        {
+            return false;
+        }
+        id = static_cast<request_id_type>(value);
+        return true;
+    }
+    catch (invalid_token_exception&)
+    {
+        return false;
+    }
 }
 
-bool process_account_answer(const buffer_type &buf, size_t buf_size,
-                            string operation,
-                            const unordered_set<string> &valid_answers,
-                            std::shared_ptr<string> result)
+void write_request_header(frame_writer &writer, opcode command,
+                          request_id_type id)
+{
+    writer.write_command(command);
+    writer.append_uint(id);
+}
+
+bool read_answer_header(frame_reader &reader, opcode command,
+                        request_id_type id)
+{
+    if (reader.read_command() != command)
+    {
+        return false;
+    }
+    return reader.read_uint() == id;
+}
+
+bool process_account_answer(frame_reader &reader, opcode operation,
+                            request_id_type id,
+                            initializer_list<result_code> valid_answers,
+                            std::shared_ptr<string> result,
+                            std::shared_ptr<string> token)
 {
-    buf_sequence buf_seq = get_buf_sequence(buf, buf_size);
     try
     {
-        string s = read_string(buf_seq);
-        if (s != UNREGISTER)
+        if (!read_answer_header(reader, operation, id))
         {
             return false;
         }
 
-        s = read_string(buf_seq);
-        if (valid_answers.find(s) == valid_answers.end())
+        result_code code = reader.read_result();
+        if (find(valid_answers.begin(), valid_answers.end(), code) ==
+            valid_answers.end())
         {
             return false;
         }
 
-        if (!is_empty(buf_seq))
+        string new_token;
+        if (token && code == result_code::OK && !reader.is_empty())
+        {
+            new_token = reader.read_string();
+        }
+
+        if (!reader.is_empty())
         {
             return false;
         }
 
-        *result = s;
+        *result = to_string(code);
+        if (token)
+        {
+            *token = move(new_token);
+        }
         return true;
     }
     catch (invalid_token_exception&)
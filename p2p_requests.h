@@ -4,29 +4,81 @@
 #include <cstdint>
 #include <cstddef>
 #include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <boost/asio/buffer.hpp>
 
 #include <p2p_common.h>
+#include "p2p_events.h"
+#include "p2p_codec.h"
 
 namespace p2p {
 
+const std::string GET_CONTACTS = "GET_CONTACTS";
+const std::string SEND_MESSAGE = "SEND_MESSAGE";
+const std::string SYNC_CONTACTS = "SYNC_CONTACTS";
+const std::string PING = "PING";
+const std::string RESUME = "RESUME";
+const std::string CONNECT_TO_CLIENT = "CONNECT_TO_CLIENT";
+const std::string CONFIRM_CONNECTION = "CONFIRM_CONNECTION";
+const std::string DISCARD_CONNECTION = "DISCARD_CONNECTION";
+const std::string CLOSE_CLIENT_CONNECTION = "CLOSE_CLIENT_CONNECTION";
+const std::string CONFIRM_READING = "CONFIRM_READING";
+const std::string DATAGRAM_TRANSPORT = "UDP";
+const std::string CUMULATIVE_ACK = "UP_TO";
+
+using request_id_type = uint32_t;
+
 class request
 {
 public:
-    virtual void fill_request(buffer_type &buf, size_t &buf_size) = 0;
-    virtual bool process_answer(const buffer_type &buf, size_t buf_size) = 0;
+    virtual ~request() {}
+
+    request_id_type id() const { return id_value; }
+    void set_id(request_id_type id) { id_value = id; }
+
+    virtual opcode command() const = 0;
+    virtual void fill_request(frame_writer &writer) = 0;
+    virtual bool process_answer(frame_reader &reader) = 0;
+
+    virtual bool expects_answer() const { return true; }
+    virtual boost::asio::const_buffer payload() const { return {}; }
+
+    virtual bool negotiates_encoding() const { return false; }
+    virtual encoding answer_encoding(encoding current) const { return current; }
+
+private:
+    request_id_type id_value = 0;
 };
 
+bool read_answer_id(frame_reader &reader, request_id_type &id);
+
 class get_version_request : public request
 {
 public:
     get_version_request(std::shared_ptr<version_type> version);
+    get_version_request(std::shared_ptr<version_type> version,
+                        std::string phone, std::string password,
+                        std::shared_ptr<std::string> autorize_result,
+                        std::shared_ptr<std::string> token);
+
+    opcode command() const override { return opcode::GET_VERSION; }
+    void fill_request(frame_writer &writer) override;
+    bool process_answer(frame_reader &reader) override;
 
-    void fill_request(buffer_type &buf, size_t &buf_size) override;
-    bool process_answer(const buffer_type &buf, size_t buf_size) override;
+    bool negotiates_encoding() const override { return true; }
+    encoding answer_encoding(encoding current) const override;
 
 private:
     std::shared_ptr<version_type> version;
+    bool binary_accepted = false;
+    std::string phone;
+    std::string password;
+    std::shared_ptr<std::string> autorize_result;
+    std::shared_ptr<std::string> token;
     bool read_version(const std::string &s);
+    bool read_autorize_answer(frame_reader &reader);
 };
 
 class register_request : public request
@@ -35,8 +87,9 @@ public:
     register_request(std::string phone, std::string password, std::string code,
                      std::shared_ptr<std::string> result);
 
-    void fill_request(buffer_type &buf, size_t &buf_size) override;
-    bool process_answer(const buffer_type &buf, size_t buf_size) override;
+    opcode command() const override { return opcode::REGISTER; }
+    void fill_request(frame_writer &writer) override;
+    bool process_answer(frame_reader &reader) override;
 
 private:
     std::string phone;
@@ -51,8 +104,9 @@ public:
     unregister_request(std::string phone, std::string password,
                        std::shared_ptr<std::string> result);
 
-    void fill_request(buffer_type &buf, size_t &buf_size) override;
-    bool process_answer(const buffer_type &buf, size_t buf_size) override;
+    opcode command() const override { return opcode::UNREGISTER; }
+    void fill_request(frame_writer &writer) override;
+    bool process_answer(frame_reader &reader) override;
 
 private:
     std::string phone;
@@ -64,15 +118,153 @@ class autorize_request : public request
 {
 public:
     autorize_request(std::string phone, std::string password,
-                     std::shared_ptr<std::string> result);
+                     std::shared_ptr<std::string> result,
+                     std::shared_ptr<std::string> token = nullptr);
 
-    void fill_request(buffer_type &buf, size_t &buf_size) override;
-    bool process_answer(const buffer_type &buf, size_t buf_size) override;
+    opcode command() const override { return opcode::AUTORIZE; }
+    void fill_request(frame_writer &writer) override;
+    bool process_answer(frame_reader &reader) override;
 
 private:
     std::string phone;
     std::string password;
     std::shared_ptr<std::string> result;
+    std::shared_ptr<std::string> token;
+};
+
+class resume_request : public request
+{
+public:
+    resume_request(std::string token, std::shared_ptr<std::string> result,
+                   std::shared_ptr<std::string> new_token);
+
+    opcode command() const override { return opcode::RESUME; }
+    void fill_request(frame_writer &writer) override;
+    bool process_answer(frame_reader &reader) override;
+
+private:
+    std::string token;
+    std::shared_ptr<std::string> result;
+    std::shared_ptr<std::string> new_token;
+};
+
+class get_contacts_request : public request
+{
+public:
+    using phones_list = std::vector<std::string>;
+    using contacts_dictionary = std::unordered_map<std::string, friend_id_type>;
+
+    get_contacts_request(phones_list phones,
+                         std::shared_ptr<contacts_dictionary> result);
+
+    opcode command() const override { return opcode::GET_CONTACTS; }
+    void fill_request(frame_writer &writer) override;
+    bool process_answer(frame_reader &reader) override;
+
+private:
+    phones_list phones;
+    std::shared_ptr<contacts_dictionary> result;
+};
+
+size_t contacts_batch_end(const get_contacts_request::phones_list &phones,
+                          size_t begin);
+
+struct contacts_delta
+{
+    uint64_t version = 0;
+    bool reset = false;
+    bool complete = true;
+    std::unordered_map<std::string, friend_id_type> changed;
+    std::vector<std::string> removed;
+};
+
+class sync_contacts_request : public request
+{
+public:
+    sync_contacts_request(uint64_t version, uint64_t hash,
+                          std::shared_ptr<contacts_delta> result);
+
+    opcode command() const override { return opcode::SYNC_CONTACTS; }
+    void fill_request(frame_writer &writer) override;
+    bool process_answer(frame_reader &reader) override;
+
+private:
+    uint64_t version;
+    uint64_t hash;
+    std::shared_ptr<contacts_delta> result;
+};
+
+class send_message_request : public request
+{
+public:
+    send_message_request(friend_id_type friend_id, message_id_type message_id,
+                         message_buffer message);
+
+    opcode command() const override { return opcode::SEND_MESSAGE; }
+    void fill_request(frame_writer &writer) override;
+    bool process_answer(frame_reader &reader) override;
+
+    bool expects_answer() const override { return false; }
+    boost::asio::const_buffer payload() const override;
+
+private:
+    friend_id_type friend_id;
+    message_id_type message_id;
+    message_buffer message;
+};
+
+class friend_request : public request
+{
+public:
+    friend_request(opcode command, friend_id_type friend_id);
+
+    opcode command() const override { return command_value; }
+    void fill_request(frame_writer &writer) override;
+    bool process_answer(frame_reader &reader) override;
+
+    bool expects_answer() const override { return false; }
+
+protected:
+    const opcode command_value;
+    const friend_id_type friend_id;
+
+    virtual void fill_params(frame_writer&) {}
+};
+
+class confirm_connection_request : public friend_request
+{
+public:
+    confirm_connection_request(friend_id_type friend_id, std::string address,
+                               uint16_t port, uint64_t token, bool datagram);
+
+private:
+    std::string address;
+    uint16_t port;
+    uint64_t token;
+    bool datagram;
+
+    void fill_params(frame_writer &writer) override;
+};
+
+class confirm_reading_request : public friend_request
+{
+public:
+    confirm_reading_request(friend_id_type friend_id,
+                            message_id_type message_id, bool up_to = false);
+
+private:
+    message_id_type message_id;
+    bool up_to;
+
+    void fill_params(frame_writer &writer) override;
+};
+
+class ping_request : public request
+{
+public:
+    opcode command() const override { return opcode::PING; }
+    void fill_request(frame_writer &writer) override;
+    bool process_answer(frame_reader &reader) override;
 };
 
 }//p2p
@@ -0,0 +1,48 @@
+#include "p2p_rtt_estimator.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+namespace p2p
+{
+
+void rtt_estimator::add_sample(duration rtt)
+{
+    int64_t r = max<int64_t>(rtt.count(), 1);
+    int64_t srtt = srtt_us.load();
+    if (srtt == 0)
+    {
+        srtt_us = r;
+        rttvar_us = r / 2;
+        return;
+    }
+
+    int64_t rttvar = rttvar_us.load();
+    rttvar_us = (3 * rttvar + llabs(srtt - r)) / 4;
+    srtt_us = max<int64_t>((7 * srtt + r) / 8, 1);
+}
+
+void rtt_estimator::reset()
+{
+    srtt_us = 0;
+    rttvar_us = 0;
+}
+
+rtt_estimator::duration rtt_estimator::rto(duration granularity,
+                                           duration min_rto, duration max_rto,
+                                           duration initial_rto) const
+{
+    if (!has_samples())
+    {
+        return initial_rto;
+    }
+
+    duration rto = srtt() + max(granularity, 4 * rttvar());
+    return min(max(rto, min_rto), max_rto);
+}
+
+}
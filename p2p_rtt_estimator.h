@@ -0,0 +1,32 @@
+#ifndef P2P_RTT_ESTIMATOR_H
+#define P2P_RTT_ESTIMATOR_H
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+namespace p2p
+{
+
+class rtt_estimator
+{
+public:
+    using duration = std::chrono::microseconds;
+
+    void add_sample(duration rtt);
+    void reset();
+
+    bool has_samples() const { return srtt_us.load() != 0; }
+    duration srtt() const { return duration{srtt_us.load()}; }
+    duration rttvar() const { return duration{rttvar_us.load()}; }
+    duration rto(duration granularity, duration min_rto, duration max_rto,
+                 duration initial_rto) const;
+
+private:
+    std::atomic<int64_t> srtt_us{0};
+    std::atomic<int64_t> rttvar_us{0};
+};
+
+}
+
+#endif // P2P_RTT_ESTIMATOR_H
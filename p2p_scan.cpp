@@ -0,0 +1,96 @@
+#include "p2p_scan.h"
+
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define P2P_SCAN_X86 1
+#include <immintrin.h>
+#else
+#define P2P_SCAN_X86 0
+#endif
+
+using namespace std;
+
+namespace p2p {
+
+namespace
+{
+
+using find_byte_function = const char *(*)(const char*, const char*, char);
+
+const char *find_byte_scalar(const char *begin, const char *end, char c)
+{
+    for (; begin != end; ++begin)
+    {
+        if (*begin == c)
+        {
+            return begin;
+        }
+    }
+    return end;
+}
+
+#if P2P_SCAN_X86
+
+__attribute__((target("sse2")))
+const char *find_byte_sse2(const char *begin, const char *end, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+    while (end - begin >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask)
+        {
+            return begin + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+        begin += 16;
+    }
+    return find_byte_scalar(begin, end, c);
+}
+
+__attribute__((target("avx2")))
+const char *find_byte_avx2(const char *begin, const char *end, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+    while (end - begin >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(begin));
+        int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if (mask)
+        {
+            return begin + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+        begin += 32;
+    }
+    return find_byte_sse2(begin, end, c);
+}
+
+#endif
+
+find_byte_function select_find_byte()
+{
+#if P2P_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return find_byte_avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return find_byte_sse2;
+    }
+#endif
+    return find_byte_scalar;
+}
+
+}
+
+const char *find_byte(const char *begin, const char *end, char c)
+{
+    static const find_byte_function find = select_find_byte();
+    return find(begin, end, c);
+}
+
+}//p2p
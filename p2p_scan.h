@@ -0,0 +1,10 @@
+#ifndef P2P_SCAN_H
+#define P2P_SCAN_H
+
+namespace p2p {
+
+const char *find_byte(const char *begin, const char *end, char c);
+
+}//p2p
+
+#endif // P2P_SCAN_H
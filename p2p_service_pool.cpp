@@ -0,0 +1,69 @@
+#include "p2p_service_pool.h"
+
+#include <cstddef>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+using namespace std;
+using namespace boost::asio;
+
+namespace p2p
+{
+
+service_pool::service_pool(size_t threads_count) :
+    work{make_unique<io_service::work>(service)}
+{
+    threads.reserve(threads_count);
+    for (size_t i = 0; i < threads_count; ++i)
+    {
+        threads.emplace_back([this]{ service.run(); });
+    }
+}
+
+service_pool::~service_pool()
+{
+    work.reset();
+    for (auto &t : threads)
+    {
+        if (t.get_id() == this_thread::get_id())
+        {
+            t.detach();
+        }
+        else
+        {
+            t.join();
+        }
+    }
+}
+
+service_pool::ptr service_pool::create(size_t threads_count)
+{
+    service_pool *p = new service_pool{threads_count};
+    return ptr{p};
+}
+
+size_t service_pool::poll()
+{
+    return service.poll();
+}
+
+size_t service_pool::run_one()
+{
+    return service.run_one();
+}
+
+size_t service_pool::run_for(std::chrono::milliseconds timeout)
+{
+    return service.run_for(timeout);
+}
+
+size_t service_pool::default_threads_count()
+{
+    size_t count = thread::hardware_concurrency();
+    return count != 0 ? count : 1;
+}
+
+}
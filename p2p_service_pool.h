@@ -0,0 +1,40 @@
+#ifndef P2P_SERVICE_POOL_H
+#define P2P_SERVICE_POOL_H
+
+#include <cstddef>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace p2p
+{
+
+class service_pool
+{
+    explicit service_pool(size_t threads_count);
+
+public:
+    ~service_pool();
+    using ptr = std::shared_ptr<service_pool>;
+    static ptr create(size_t threads_count = default_threads_count());
+    static size_t default_threads_count();
+
+    boost::asio::io_service &get_service() { return service; }
+    size_t threads_count() const { return threads.size(); }
+    bool is_caller_driven() const { return threads.empty(); }
+
+    size_t poll();
+    size_t run_one();
+    size_t run_for(std::chrono::milliseconds timeout);
+
+private:
+    boost::asio::io_service service;
+    std::unique_ptr<boost::asio::io_service::work> work;
+    std::vector<std::thread> threads;
+};
+
+}
+
+#endif // P2P_SERVICE_POOL_H
@@ -0,0 +1,216 @@
+#include "p2p_timer_wheel.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <vector>
+#include <functional>
+#include <utility>
+
+using namespace std;
+
+namespace p2p
+{
+
+constexpr size_t timer_wheel::SLOT_BITS;
+constexpr size_t timer_wheel::SLOTS_COUNT;
+constexpr size_t timer_wheel::LEVELS_COUNT;
+constexpr uint32_t timer_wheel::NIL;
+
+array<uint32_t, timer_wheel::LEVELS_COUNT * timer_wheel::SLOTS_COUNT>
+timer_wheel::make_slots()
+{
+    array<uint32_t, LEVELS_COUNT * SLOTS_COUNT> s;
+    s.fill(NIL);
+    return s;
+}
+
+timer_wheel::timer_id timer_wheel::add(uint64_t ticks, callback cb)
+{
+    uint32_t index;
+    if (free_nodes != NIL)
+    {
+        index = free_nodes;
+        free_nodes = nodes[index].next;
+    }
+    else
+    {
+        index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+    }
+
+    node &n = nodes[index];
+    n.expires = now + (ticks == 0 ? 1 : ticks);
+    n.cb = move(cb);
+    link(index);
+    ++active_count;
+    return static_cast<timer_id>(n.generation) << 32 | index;
+}
+
+bool timer_wheel::cancel(timer_id id)
+{
+    auto index = static_cast<uint32_t>(id);
+    auto generation = static_cast<uint32_t>(id >> 32);
+    if (index >= nodes.size() || nodes[index].generation != generation ||
+        nodes[index].slot == NIL)
+    {
+        return false;
+    }
+
+    unlink(index);
+    free_node(index);
+    return true;
+}
+
+void timer_wheel::advance(uint64_t ticks)
+{
+    for (; ticks != 0 && !empty(); --ticks)
+    {
+        tick();
+    }
+    now += ticks;
+}
+
+void timer_wheel::clear()
+{
+    for (uint32_t index = 0; index < nodes.size(); ++index)
+    {
+        if (nodes[index].slot != NIL)
+        {
+            unlink(index);
+            free_node(index);
+        }
+    }
+}
+
+uint64_t timer_wheel::ticks_to_next_event() const
+{
+    if (empty())
+    {
+        return 0;
+    }
+
+    for (size_t level = 0; level < LEVELS_COUNT; ++level)
+    {
+        uint64_t position = now >> (SLOT_BITS * level);
+        for (uint64_t i = 1; i <= SLOTS_COUNT; ++i)
+        {
+            size_t slot = level * SLOTS_COUNT +
+                    ((position + i) & (SLOTS_COUNT - 1));
+            if (slots[slot] != NIL)
+            {
+                return ((position + i) << (SLOT_BITS * level)) - now;
+            }
+        }
+    }
+    return 1;
+}
+
+void timer_wheel::link(uint32_t index)
+{
+    node &n = nodes[index];
+    uint64_t expires = n.expires > now ? n.expires : now;
+    size_t level = 0;
+    while (level < LEVELS_COUNT &&
+           expires >> (SLOT_BITS * (level + 1)) !=
+           now >> (SLOT_BITS * (level + 1)))
+    {
+        ++level;
+    }
+
+    uint64_t position;
+    if (level == LEVELS_COUNT)
+    {
+        level = LEVELS_COUNT - 1;
+        position = 0;
+    }
+    else
+    {
+        position = expires >> (SLOT_BITS * level);
+    }
+    size_t slot = level * SLOTS_COUNT + (position & (SLOTS_COUNT - 1));
+
+    n.slot = static_cast<uint32_t>(slot);
+    n.prev = NIL;
+    n.next = slots[slot];
+    if (n.next != NIL)
+    {
+        nodes[n.next].prev = index;
+    }
+    slots[slot] = index;
+}
+
+void timer_wheel::unlink(uint32_t index)
+{
+    node &n = nodes[index];
+    if (n.prev != NIL)
+    {
+        nodes[n.prev].next = n.next;
+    }
+    else
+    {
+        slots[n.slot] = n.next;
+    }
+    if (n.next != NIL)
+    {
+        nodes[n.next].prev = n.prev;
+    }
+    n.slot = NIL;
+    n.prev = NIL;
+    n.next = NIL;
+}
+
+void timer_wheel::free_node(uint32_t index)
+{
+    node &n = nodes[index];
+    n.cb = nullptr;
+    ++n.generation;
+    n.next = free_nodes;
+    free_nodes = index;
+    --active_count;
+}
+
+void timer_wheel::cascade(size_t level)
+{
+    size_t slot = level * SLOTS_COUNT +
+            ((now >> (SLOT_BITS * level)) & (SLOTS_COUNT - 1));
+    uint32_t index = slots[slot];
+    slots[slot] = NIL;
+    while (index != NIL)
+    {
+        uint32_t next = nodes[index].next;
+        link(index);
+        index = next;
+    }
+}
+
+void timer_wheel::tick()
+{
+    ++now;
+    for (size_t level = 1; level < LEVELS_COUNT; ++level)
+    {
+        if ((now & ((uint64_t{1} << (SLOT_BITS * level)) - 1)) != 0)
+        {
+            break;
+        }
+        cascade(level);
+    }
+
+    size_t slot = now & (SLOTS_COUNT - 1);
+    while (slots[slot] != NIL)
+    {
+        uint32_t index = slots[slot];
+        unlink(index);
+        if (nodes[index].expires > now)
+        {
+            link(index);
+            continue;
+        }
+
+        callback cb = move(nodes[index].cb);
+        free_node(index);
+        cb();
+    }
+}
+
+}
@@ -0,0 +1,61 @@
+#ifndef P2P_TIMER_WHEEL_H
+#define P2P_TIMER_WHEEL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <vector>
+#include <functional>
+
+namespace p2p
+{
+
+class timer_wheel
+{
+public:
+    using timer_id = uint64_t;
+    using callback = std::function<void()>;
+
+    timer_id add(uint64_t ticks, callback cb);
+    bool cancel(timer_id id);
+    void advance(uint64_t ticks);
+    void clear();
+    uint64_t ticks_to_next_event() const;
+
+    bool empty() const { return active_count == 0; }
+    size_t size() const { return active_count; }
+
+private:
+    static constexpr size_t SLOT_BITS = 6;
+    static constexpr size_t SLOTS_COUNT = size_t{1} << SLOT_BITS;
+    static constexpr size_t LEVELS_COUNT = 4;
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    struct node
+    {
+        uint64_t expires = 0;
+        uint32_t generation = 1;
+        uint32_t prev = NIL;
+        uint32_t next = NIL;
+        uint32_t slot = NIL;
+        callback cb;
+    };
+
+    std::vector<node> nodes;
+    uint32_t free_nodes = NIL;
+    std::array<uint32_t, LEVELS_COUNT * SLOTS_COUNT> slots = make_slots();
+    uint64_t now = 0;
+    size_t active_count = 0;
+
+    static std::array<uint32_t, LEVELS_COUNT * SLOTS_COUNT> make_slots();
+
+    void link(uint32_t index);
+    void unlink(uint32_t index);
+    void free_node(uint32_t index);
+    void cascade(size_t level);
+    void tick();
+};
+
+}
+
+#endif // P2P_TIMER_WHEEL_H
@@ -0,0 +1,689 @@
+#include "p2p_udp_peer_link.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <boost/asio.hpp>
+
+#include "p2p_common.h"
+#include "p2p_events.h"
+#include "p2p_codec.h"
+
+using namespace std;
+using namespace boost::asio;
+using boost::asio::ip::udp;
+using boost_error = boost::system::error_code;
+using std::chrono::steady_clock;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+
+namespace p2p
+{
+
+constexpr size_t FRAGMENT_SIZE = 1200;
+constexpr uint64_t MAX_FRAGMENTS =
+        (MAX_PEER_MESSAGE_SIZE + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE + 1;
+constexpr uint64_t RECEIVE_WINDOW = 2 * MAX_FRAGMENTS;
+constexpr size_t MAX_SACK_RANGES = 16;
+constexpr size_t MAX_RECEIVE_BATCH = 64;
+constexpr int SOCKET_BUFFER_SIZE = 1024 * 1024;
+constexpr unsigned MAX_RETRANSMIT_TIMEOUTS = 8;
+constexpr unsigned MAX_TAIL_PROBES = 2;
+constexpr double MIN_WINDOW = 2;
+constexpr double INITIAL_WINDOW = 10;
+constexpr double MAX_WINDOW = 1024;
+const milliseconds MIN_RTO{50};
+const milliseconds MAX_RTO{10000};
+const milliseconds INITIAL_RTO{1000};
+const milliseconds MIN_PROBE_TIMEOUT{10};
+
+static size_t frame_header_size(const char *data, size_t size)
+{
+    if (size < BINARY_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    size_t frame_size = 0;
+    for (size_t i = 0; i < BINARY_HEADER_SIZE; ++i)
+    {
+        frame_size |= static_cast<size_t>(
+                    static_cast<unsigned char>(data[i])) << (8 * i);
+    }
+    if (frame_size == 0 || frame_size > size - BINARY_HEADER_SIZE)
+    {
+        return 0;
+    }
+    return BINARY_HEADER_SIZE + frame_size;
+}
+
+udp_peer_link::udp_peer_link(io_service &service, io_service::strand strand) :
+    strand{strand}, link_socket{service}, random{random_device{}()},
+    cwnd{INITIAL_WINDOW}, ssthresh{MAX_WINDOW}, retransmit_timer{service},
+    pace_timer{service}
+{
+}
+
+udp_peer_link::ptr udp_peer_link::create(io_service &service,
+                                         io_service::strand strand)
+{
+    return ptr{new udp_peer_link{service, strand}};
+}
+
+bool udp_peer_link::bind(const ip::address &local)
+{
+    boost_error ec;
+    udp::endpoint endpoint{local, 0};
+    link_socket.open(endpoint.protocol(), ec);
+    if (!ec)
+    {
+        link_socket.bind(endpoint, ec);
+    }
+    if (!ec)
+    {
+        link_socket.non_blocking(true, ec);
+    }
+    if (!ec)
+    {
+        boost_error ignored;
+        link_socket.set_option(socket_base::receive_buffer_size(
+                                   SOCKET_BUFFER_SIZE), ignored);
+        link_socket.set_option(socket_base::send_buffer_size(
+                                   SOCKET_BUFFER_SIZE), ignored);
+    }
+    if (ec)
+    {
+        link_socket.close(ec);
+        return false;
+    }
+    return true;
+}
+
+void udp_peer_link::set_remote(const udp::endpoint &endpoint)
+{
+    remote = endpoint;
+    has_remote = true;
+}
+
+uint16_t udp_peer_link::local_port() const
+{
+    boost_error ec;
+    return link_socket.local_endpoint(ec).port();
+}
+
+void udp_peer_link::start(frame_handler handler, close_handler closed)
+{
+    on_frame = move(handler);
+    on_close = move(closed);
+    open = true;
+    start_receive();
+    pace();
+}
+
+void udp_peer_link::send(opcode command, uint64_t value, message_buffer body)
+{
+    pooled_buffer header;
+    size_t header_size = 0;
+    write_peer_frame(header, header_size, {command, value, body});
+
+    size_t body_size = body ? body->size() : 0;
+    size_t total = header_size + body_size;
+    uint64_t count = (total + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE;
+    for (uint64_t index = 0; index < count; ++index)
+    {
+        uint64_t seq = next_seq++;
+        pooled_buffer buf;
+        size_t buf_size = 0;
+        frame_writer writer{encoding::BINARY, buf, buf_size};
+        writer.write_command(opcode::PEER_DATA);
+        writer.append_uint(seq);
+        writer.append_uint(index);
+        writer.append_uint(count);
+        writer.finalize();
+
+        packet &p = unacked[seq];
+        size_t begin = static_cast<size_t>(index) * FRAGMENT_SIZE;
+        size_t end = min(begin + FRAGMENT_SIZE, total);
+        p.data.reserve(buf_size + end - begin);
+        p.data.assign(buf.data(), buf_size);
+        if (begin < header_size)
+        {
+            p.data.append(header.data() + begin,
+                          min(end, header_size) - begin);
+        }
+        if (end > header_size)
+        {
+            size_t from = max(begin, header_size) - header_size;
+            p.data.append(*body, from, end - header_size - from);
+        }
+        send_queue.push_back(seq);
+    }
+
+    if (open)
+    {
+        pace();
+    }
+}
+
+void udp_peer_link::close()
+{
+    open = false;
+    on_frame = nullptr;
+    on_close = nullptr;
+    boost_error ec;
+    retransmit_timer.cancel(ec);
+    pace_timer.cancel(ec);
+    link_socket.close(ec);
+    unacked.clear();
+    send_queue.clear();
+    received.clear();
+    partials.clear();
+}
+
+void udp_peer_link::close_when_sent()
+{
+    on_frame = nullptr;
+    on_close = nullptr;
+    closing = true;
+    if (unacked.empty())
+    {
+        close();
+    }
+}
+
+void udp_peer_link::fail()
+{
+    if (!open)
+    {
+        return;
+    }
+
+    auto handler = move(on_close);
+    close();
+    if (handler)
+    {
+        handler();
+    }
+}
+
+void udp_peer_link::transmit(const char *data, size_t size)
+{
+    if (!has_remote ||
+        (loss > 0 && uniform_real_distribution<double>{}(random) < loss))
+    {
+        return;
+    }
+
+    boost_error ec;
+    link_socket.send_to(buffer(data, size), remote, 0, ec);
+}
+
+microseconds udp_peer_link::pacing_interval() const
+{
+    if (!rtt.has_samples())
+    {
+        return microseconds{0};
+    }
+    return duration_cast<microseconds>(rtt.srtt() / (2 * cwnd));
+}
+
+void udp_peer_link::pace()
+{
+    if (pacing || !open)
+    {
+        return;
+    }
+
+    auto now = steady_clock::now();
+    while (!send_queue.empty())
+    {
+        auto it = unacked.find(send_queue.front());
+        if (it == unacked.end())
+        {
+            send_queue.pop_front();
+            continue;
+        }
+
+        packet &p = it->second;
+        if (!p.in_flight && flight >= cwnd)
+        {
+            break;
+        }
+        if (next_send > now)
+        {
+            pacing = true;
+            pace_timer.expires_from_now(boost::posix_time::microseconds(
+                    duration_cast<microseconds>(next_send - now).count()));
+            pace_timer.async_wait(strand.wrap(
+                                  [self = shared_from_this()](boost_error ec)
+                                  {
+                                      if (ec == error::operation_aborted ||
+                                          !self->open)
+                                      {
+                                          return;
+                                      }
+                                      self->pacing = false;
+                                      self->pace();
+                                  }));
+            break;
+        }
+
+        send_queue.pop_front();
+        p.queued = false;
+        if (!p.in_flight)
+        {
+            p.in_flight = true;
+            ++flight;
+        }
+        p.sent = now;
+        transmit(p.data.data(), p.data.size());
+        next_send = max(next_send, now) + pacing_interval();
+    }
+
+    if (!retransmit_armed && flight > 0)
+    {
+        arm_retransmit();
+    }
+}
+
+void udp_peer_link::arm_retransmit()
+{
+    auto rto = rtt.rto(milliseconds{1}, MIN_RTO, MAX_RTO, INITIAL_RTO);
+    rto = min<microseconds>(rto * (1u << timeouts), MAX_RTO);
+    if (probes < MAX_TAIL_PROBES && timeouts == 0 && rtt.has_samples())
+    {
+        rto = min<microseconds>(max<microseconds>(2 * rtt.srtt(),
+                                                  MIN_PROBE_TIMEOUT), rto);
+    }
+    retransmit_armed = true;
+    retransmit_timer.expires_from_now(
+                boost::posix_time::microseconds(rto.count()));
+    retransmit_timer.async_wait(strand.wrap(
+                                [self = shared_from_this()](boost_error ec)
+                                {
+                                    if (ec == error::operation_aborted ||
+                                        !self->open ||
+                                        self->retransmit_timer.expires_at() >
+                                        deadline_timer::traits_type::now())
+                                    {
+                                        return;
+                                    }
+                                    self->retransmit_armed = false;
+                                    self->retransmit_timeout();
+                                }));
+}
+
+void udp_peer_link::retransmit_timeout()
+{
+    if (flight == 0)
+    {
+        return;
+    }
+
+    if (probes < MAX_TAIL_PROBES && timeouts == 0 && rtt.has_samples())
+    {
+        auto last = find_if(unacked.rbegin(), unacked.rend(),
+                            [](const pair<const uint64_t, packet> &item)
+                            {
+                                return item.second.in_flight;
+                            });
+        ++probes;
+        if (!last->second.queued)
+        {
+            retransmit(last->second, last->first);
+        }
+        arm_retransmit();
+        pace();
+        return;
+    }
+
+    if (closing)
+    {
+        close();
+        return;
+    }
+    if (++timeouts > MAX_RETRANSMIT_TIMEOUTS)
+    {
+        fail();
+        return;
+    }
+
+    enter_recovery(MIN_WINDOW);
+    for (auto it = unacked.rbegin(); it != unacked.rend(); ++it)
+    {
+        if (it->second.in_flight && !it->second.queued)
+        {
+            retransmit(it->second, it->first);
+        }
+    }
+    next_send = steady_clock::now();
+    arm_retransmit();
+    pace();
+}
+
+void udp_peer_link::retransmit(packet &p, uint64_t seq)
+{
+    p.queued = true;
+    p.retransmitted = true;
+    send_queue.push_front(seq);
+}
+
+void udp_peer_link::enter_recovery(double window)
+{
+    ssthresh = max(cwnd / 2, MIN_WINDOW);
+    cwnd = max(window, MIN_WINDOW);
+    recovery_end = next_seq - 1;
+}
+
+void udp_peer_link::start_receive()
+{
+    link_socket.async_receive_from(
+                buffer(receive_buf), sender, strand.wrap(
+                [self = shared_from_this()](boost_error ec, size_t bytes)
+                {
+                    if (ec == error::operation_aborted || !self->open)
+                    {
+                        return;
+                    }
+                    for (size_t i = 0; !ec && self->open &&
+                         i < MAX_RECEIVE_BATCH; ++i)
+                    {
+                        if (!self->has_remote)
+                        {
+                            self->set_remote(self->sender);
+                        }
+                        if (self->sender == self->remote &&
+                            !self->receive_packet(self->receive_buf.data(),
+                                                  bytes))
+                        {
+                            self->fail();
+                            return;
+                        }
+                        bytes = self->link_socket.receive_from(
+                                    buffer(self->receive_buf), self->sender,
+                                    0, ec);
+                    }
+                    if (self->open)
+                    {
+                        if (self->ack_pending)
+                        {
+                            self->send_ack();
+                        }
+                        self->start_receive();
+                    }
+                }));
+}
+
+bool udp_peer_link::receive_packet(const char *data, size_t size)
+{
+    size_t header_size = frame_header_size(data, size);
+    if (header_size == 0)
+    {
+        return true;
+    }
+
+    try
+    {
+        frame_reader reader{encoding::BINARY, data + BINARY_HEADER_SIZE,
+                            header_size - BINARY_HEADER_SIZE};
+        switch (reader.read_command())
+        {
+        case opcode::PEER_DATA:
+            return receive_data(reader, data + header_size,
+                                size - header_size);
+        case opcode::PEER_ACK:
+            return receive_ack(reader);
+        default:
+            return true;
+        }
+    }
+    catch (invalid_token_exception&)
+    {
+        return true;
+    }
+}
+
+bool udp_peer_link::receive_data(frame_reader &reader, const char *chunk,
+                                 size_t size)
+{
+    uint64_t seq = reader.read_uint();
+    uint64_t index = reader.read_uint();
+    uint64_t count = reader.read_uint();
+    if (!reader.is_empty() || size == 0 || count == 0 || index >= count ||
+        count > MAX_FRAGMENTS || index >= seq)
+    {
+        return true;
+    }
+    if (seq >= next_expected + RECEIVE_WINDOW)
+    {
+        return true;
+    }
+
+    if (seq >= next_expected && received.insert(seq).second)
+    {
+        while (!received.empty() && *received.begin() == next_expected)
+        {
+            received.erase(received.begin());
+            ++next_expected;
+        }
+
+        uint64_t first = seq - index;
+        partial &part = partials[first];
+        if (part.parts.empty())
+        {
+            part.parts.resize(static_cast<size_t>(count));
+        }
+        else if (part.parts.size() != count)
+        {
+            return false;
+        }
+        part.parts[static_cast<size_t>(index)].assign(chunk, size);
+        if (++part.received == count)
+        {
+            string data;
+            for (auto &p : part.parts)
+            {
+                data += p;
+            }
+            partials.erase(first);
+            if (!deliver(first + count - 1, data))
+            {
+                return false;
+            }
+        }
+    }
+
+    if (!open)
+    {
+        return true;
+    }
+    if (ack_pending)
+    {
+        send_ack();
+    }
+    else
+    {
+        ack_pending = true;
+    }
+
+    if (bye_seq != 0 && next_expected > bye_seq && on_frame)
+    {
+        bye_seq = 0;
+        on_frame({opcode::PEER_BYE, bye_value, nullptr});
+    }
+    return true;
+}
+
+bool udp_peer_link::deliver(uint64_t last, const string &data)
+{
+    size_t header_size = frame_header_size(data.data(), data.size());
+    opcode command;
+    uint64_t value;
+    uint64_t body_size;
+    if (header_size == 0 ||
+        !read_peer_frame(data.data() + BINARY_HEADER_SIZE,
+                         header_size - BINARY_HEADER_SIZE,
+                         command, value, body_size) ||
+        data.size() != header_size + body_size)
+    {
+        return false;
+    }
+
+    if (command == opcode::PEER_BYE && next_expected <= last)
+    {
+        bye_seq = last;
+        bye_value = value;
+        return true;
+    }
+
+    message_buffer body;
+    if (command == opcode::PEER_MESSAGE)
+    {
+        body = make_shared<const string>(data, header_size);
+    }
+    if (on_frame)
+    {
+        on_frame({command, value, move(body)});
+    }
+    return true;
+}
+
+void udp_peer_link::send_ack()
+{
+    ack_pending = false;
+    pooled_buffer buf;
+    size_t buf_size = 0;
+    frame_writer writer{encoding::BINARY, buf, buf_size};
+    writer.write_command(opcode::PEER_ACK);
+    writer.append_uint(next_expected);
+    size_t ranges = 0;
+    for (auto it = received.begin();
+         it != received.end() && ranges < MAX_SACK_RANGES; ++ranges)
+    {
+        uint64_t begin = *it;
+        uint64_t end = begin;
+        while (it != received.end() && *it == end)
+        {
+            ++it;
+            ++end;
+        }
+        writer.append_uint(begin);
+        writer.append_uint(end);
+    }
+    writer.finalize();
+    transmit(buf.data(), buf_size);
+}
+
+bool udp_peer_link::receive_ack(frame_reader &reader)
+{
+    uint64_t cumulative = reader.read_uint();
+    vector<pair<uint64_t, uint64_t>> ranges;
+    while (!reader.is_empty() && ranges.size() < MAX_SACK_RANGES)
+    {
+        uint64_t begin = reader.read_uint();
+        uint64_t end = reader.read_uint();
+        ranges.emplace_back(begin, end);
+    }
+    if (cumulative > next_seq)
+    {
+        return true;
+    }
+
+    auto now = steady_clock::now();
+    bool progress = false;
+    bool has_sample = false;
+    steady_clock::time_point sample_sent;
+    auto acknowledge = [&](map<uint64_t, packet>::iterator it)
+    {
+        packet &p = it->second;
+        if (p.in_flight)
+        {
+            --flight;
+            latest_acked_sent = max(latest_acked_sent, p.sent);
+            if (!p.retransmitted && (!has_sample || p.sent > sample_sent))
+            {
+                has_sample = true;
+                sample_sent = p.sent;
+            }
+            if (it->first > recovery_end)
+            {
+                cwnd = min(cwnd < ssthresh ? cwnd + 1 : cwnd + 1 / cwnd,
+                           MAX_WINDOW);
+            }
+        }
+        progress = true;
+        return unacked.erase(it);
+    };
+
+    for (auto it = unacked.begin();
+         it != unacked.end() && it->first < cumulative;)
+    {
+        it = acknowledge(it);
+    }
+
+    uint64_t highest_sacked = 0;
+    for (auto &range : ranges)
+    {
+        for (auto it = unacked.lower_bound(range.first);
+             it != unacked.end() && it->first < range.second;)
+        {
+            it = acknowledge(it);
+        }
+        if (range.second > range.first)
+        {
+            highest_sacked = max(highest_sacked, range.second - 1);
+        }
+    }
+
+    auto reordering = rtt.srtt() / 4;
+    uint64_t first_lost = 0;
+    for (auto it = unacked.rbegin(); it != unacked.rend(); ++it)
+    {
+        packet &p = it->second;
+        if (it->first < highest_sacked && p.in_flight && !p.queued &&
+            p.sent + reordering < latest_acked_sent)
+        {
+            retransmit(p, it->first);
+            first_lost = it->first;
+        }
+    }
+    if (first_lost > recovery_end)
+    {
+        enter_recovery(cwnd / 2);
+    }
+
+    if (has_sample)
+    {
+        rtt.add_sample(duration_cast<microseconds>(now - sample_sent));
+    }
+    if (progress)
+    {
+        timeouts = 0;
+        probes = 0;
+        if (flight > 0)
+        {
+            arm_retransmit();
+        }
+        else
+        {
+            boost_error ec;
+            retransmit_timer.cancel(ec);
+            retransmit_armed = false;
+        }
+    }
+
+    if (closing && unacked.empty())
+    {
+        close();
+        return true;
+    }
+    pace();
+    return true;
+}
+
+}
@@ -0,0 +1,125 @@
+#ifndef P2P_UDP_PEER_LINK_H
+#define P2P_UDP_PEER_LINK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <map>
+#include <set>
+#include <array>
+#include <chrono>
+#include <random>
+#include <boost/asio.hpp>
+
+#include "p2p_common.h"
+#include "p2p_codec.h"
+#include "p2p_peer_link.h"
+#include "p2p_rtt_estimator.h"
+
+namespace p2p
+{
+
+const std::string PEER_DATA = "PEER_DATA";
+const std::string PEER_ACK = "PEER_ACK";
+
+constexpr size_t MAX_DATAGRAM_SIZE = 1232;
+
+class udp_peer_link : public peer_link,
+                      public std::enable_shared_from_this<udp_peer_link>
+{
+    udp_peer_link(boost::asio::io_service &service,
+                  boost::asio::io_service::strand strand);
+
+public:
+    using ptr = std::shared_ptr<udp_peer_link>;
+    static ptr create(boost::asio::io_service &service,
+                      boost::asio::io_service::strand strand);
+
+    bool bind(const boost::asio::ip::address &local);
+    void set_remote(const boost::asio::ip::udp::endpoint &endpoint);
+    uint16_t local_port() const;
+    void set_loss(double probability) { loss = probability; }
+
+    void start(frame_handler handler, close_handler on_close) override;
+    void send(opcode command, uint64_t value,
+              message_buffer body = nullptr) override;
+    void close() override;
+    void close_when_sent() override;
+    bool is_open() const override { return open; }
+    bool has_gaps() const override { return !received.empty(); }
+
+private:
+    boost::asio::io_service::strand strand;
+    boost::asio::ip::udp::socket link_socket;
+    boost::asio::ip::udp::endpoint remote;
+    bool has_remote = false;
+    bool open = false;
+    bool closing = false;
+    frame_handler on_frame;
+    close_handler on_close;
+    double loss = 0;
+    std::minstd_rand random;
+
+    struct packet
+    {
+        std::string data;
+        std::chrono::steady_clock::time_point sent;
+        bool in_flight = false;
+        bool queued = true;
+        bool retransmitted = false;
+    };
+    uint64_t next_seq = 1;
+    std::map<uint64_t, packet> unacked;
+    std::deque<uint64_t> send_queue;
+    size_t flight = 0;
+    double cwnd;
+    double ssthresh;
+    uint64_t recovery_end = 0;
+    std::chrono::steady_clock::time_point latest_acked_sent;
+    rtt_estimator rtt;
+    unsigned timeouts = 0;
+    unsigned probes = 0;
+    boost::asio::deadline_timer retransmit_timer;
+    bool retransmit_armed = false;
+    boost::asio::deadline_timer pace_timer;
+    bool pacing = false;
+    std::chrono::steady_clock::time_point next_send;
+
+    uint64_t next_expected = 1;
+    std::set<uint64_t> received;
+    struct partial
+    {
+        std::vector<std::string> parts;
+        size_t received = 0;
+    };
+    std::map<uint64_t, partial> partials;
+    uint64_t bye_seq = 0;
+    uint64_t bye_value = 0;
+    bool ack_pending = false;
+
+    std::array<char, MAX_DATAGRAM_SIZE> receive_buf;
+    boost::asio::ip::udp::endpoint sender;
+
+    void fail();
+    void transmit(const char *data, size_t size);
+    void pace();
+    std::chrono::microseconds pacing_interval() const;
+    void arm_retransmit();
+    void retransmit_timeout();
+    void retransmit(packet &p, uint64_t seq);
+    void enter_recovery(double window);
+
+    void start_receive();
+    bool receive_packet(const char *data, size_t size);
+    bool receive_data(frame_reader &reader, const char *chunk, size_t size);
+    bool receive_ack(frame_reader &reader);
+    bool deliver(uint64_t last, const std::string &data);
+    void send_ack();
+};
+
+}
+
+#endif // P2P_UDP_PEER_LINK_H